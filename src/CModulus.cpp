@@ -23,6 +23,9 @@
  * time & frequency domains. Some tables are computed the first time that
  * each directions is called, which are then used in subsequent computations.
  * 
+ * The tables themselves depend only on (m,q), and they are shared between
+ * all the Cmodulus objects (across all contexts) that use the same (m,q).
+ * 
  * The "time domain" polynomials are represented as ZZX, which are reduced
  * modulo Phi_m(X). The "frequency domain" are jusr vectors of integers
  * (vec_long), that store only the evaluation in primitive m-th
@@ -31,6 +34,8 @@
 
 #include "CModulus.h"
 #include "timing.h"
+#include "multicore.h"
+#include <map>
 
 
 // It is assumed that m,q,context, and root are already set. If root is set
@@ -46,6 +51,106 @@ zz_pContext BuildContext(long p, long maxroot) {
 }
 
 
+// Build the FFT tables, it is assumed that NTL's current modulus is q
+CmodTables::CmodTables(const PAlgebra& zms, const zz_pContext& cntxt,
+                       long q, long rt): context(cntxt), root(rt)
+{
+  long mm = zms.getM();
+
+  if (root==0) { // Find a 2m-th root of unity modulo q, if not given
+    zz_p rtp;
+    long e = 2*mm;
+    FindPrimitiveRoot(rtp,e); // NTL routine, relative to current modulus
+    if (rtp==0) // sanity check
+      Error("Cmod::compRoots(): no 2m'th roots of unity mod q");
+    root = rep(rtp);
+  }
+  rInv = InvMod(root,q); // set rInv = root^{-1} mod q
+
+  zz_pX phimx_poly;
+  conv(phimx_poly, zms.getPhimX());
+  phimx.reset(new zz_pXModulus1(mm, phimx_poly));
+
+  BluesteinInit(mm, conv<zz_p>(root), powers, powers_aux, Rb);
+  BluesteinInit(mm, conv<zz_p>(rInv), ipowers, ipowers_aux, iRb);
+}
+
+CmodTables::CmodTables(const PAlgebra& zms, const zz_pContext& cntxt,
+                       long q, long rt, const long* pw, const long* ipw):
+  context(cntxt), root(rt)
+{
+  long mm = zms.getM();
+  rInv = InvMod(root,q);
+
+  zz_pX phimx_poly;
+  conv(phimx_poly, zms.getPhimX());
+  phimx.reset(new zz_pXModulus1(mm, phimx_poly));
+
+  powers.rep.SetLength(mm);
+  ipowers.rep.SetLength(mm);
+  for (long i=0; i<mm; i++) {
+    conv(powers.rep[i], pw[i]);
+    conv(ipowers.rep[i], ipw[i]);
+  }
+  powers.normalize();
+  ipowers.normalize();
+
+  BluesteinTables(mm, powers, ipowers, powers_aux, Rb);
+  BluesteinTables(mm, ipowers, powers, ipowers_aux, iRb);
+}
+
+// A process-wide registry of the tables, indexed by (m,q,rt). We only keep
+// weak pointers here, so the tables are freed when no Cmodulus uses them,
+// and the expired entries are erased whenever new tables are registered.
+typedef map< vector<long>, weak_ptr<const CmodTables> > CmodRegistry;
+static CmodRegistry cmodRegistry;
+static FHE_MUTEX_TYPE cmodRegistryMx;
+
+long Cmodulus::sharedTablesCount()
+{
+  FHE_MUTEX_GUARD(cmodRegistryMx);
+  long count = 0;
+  for (CmodRegistry::iterator it = cmodRegistry.begin();
+       it != cmodRegistry.end(); ++it)
+    if (!it->second.expired()) count++;
+  return count;
+}
+
+// Look up the tables for (m,q,rt) in the registry, and build them if they
+// are not there, from the saved powers if pw!=NULL
+static shared_ptr<const CmodTables>
+sharedTables(const PAlgebra &zms, long q, long rt,
+             const long* pw=NULL, const long* ipw=NULL)
+{
+  long mm = zms.getM();
+  vector<long> key(3);
+  key[0] = mm; key[1] = q; key[2] = rt;
+
+  FHE_MUTEX_GUARD(cmodRegistryMx);
+  weak_ptr<const CmodTables>& entry = cmodRegistry[key];
+  shared_ptr<const CmodTables> tables = entry.lock();
+  if (!tables) { // not found, build new tables and register them
+    // First drop the entries of the tables that were freed, so the registry
+    // only grows with the number of tables alive (e.g. across the contexts
+    // of a parameter search)
+    for (CmodRegistry::iterator it = cmodRegistry.begin();
+         it != cmodRegistry.end(); )
+      if (it->first != key && it->second.expired()) cmodRegistry.erase(it++);
+      else ++it;
+
+    zz_pBak bak;
+    bak.save(); // backup the current modulus
+    zz_pContext cntxt = BuildContext(q, NextPowerOfTwo(mm) + 1);
+    cntxt.restore();       // set NTL's current modulus to q
+    if (pw == NULL)
+      tables.reset(new CmodTables(zms, cntxt, q, rt));
+    else
+      tables.reset(new CmodTables(zms, cntxt, q, rt, pw, ipw));
+    entry = tables;
+  }
+  return tables;
+}
+
 // Constructor: it is assumed that zms is already set with m>1
 // If q == 0, then the current context is used
 Cmodulus::Cmodulus(const PAlgebra &zms, long qq, long rt)
@@ -61,46 +166,38 @@ Cmodulus::Cmodulus(const PAlgebra &zms, long qq, long rt)
     q = qq;
 
   zMStar = &zms;
-  root = rt;
 
   long mm;
   mm = zms.getM();
   m_inv = InvMod(mm, q);
 
-  zz_pBak bak; 
-
-  if (explicitModulus) {
-    bak.save(); // backup the current modulus
-    context = BuildContext(q, NextPowerOfTwo(zms.getM()) + 1);
-    context.restore();       // set NTL's current modulus to q
-  }
-  else
+  if (!explicitModulus) {
+    // The current NTL context is used, the tables are not shared
     context.save();
-
-  if (root==0) { // Find a 2m-th root of unity modulo q, if not given
-    zz_p rtp;
-    long e = 2*zms.getM();
-    FindPrimitiveRoot(rtp,e); // NTL routine, relative to current modulus
-    if (rtp==0) // sanity check
-      Error("Cmod::compRoots(): no 2m'th roots of unity mod q");
-    root = rep(rtp);
+    tables.reset(new CmodTables(zms, context, q, rt));
   }
-  rInv = InvMod(root,q); // set rInv = root^{-1} mod q
-
-  // Allocate memory (relative to current modulus that was defined above).
-  // These objects will be initialized when anyone calls FFT/iFFT.
-
-  zz_pX phimx_poly;
-  conv(phimx_poly, zms.getPhimX());
+  else {
+    tables = sharedTables(zms, q, rt);
+    context = tables->context;
+  }
+  root = tables->root;
+  rInv = tables->rInv;
+}
 
-  powers.set_ptr(new zz_pX);
-  Rb.set_ptr(new fftRep);
-  ipowers.set_ptr(new zz_pX);
-  iRb.set_ptr(new fftRep);
-  phimx.set_ptr(new zz_pXModulus1(zms.getM(), phimx_poly));
+// The tables are registered under the saved root, so they are only shared
+// with other objects built from the same snapshot
+Cmodulus::Cmodulus(const PAlgebra &zms, long qq, long rt,
+                   const long* pw, const long* ipw)
+{
+  assert(zms.getM()>1 && qq>0 && rt>0);
+  q = qq;
+  zMStar = &zms;
+  m_inv = InvMod((long) zms.getM(), q);
 
-  BluesteinInit(mm, conv<zz_p>(root), *powers, powers_aux, *Rb);
-  BluesteinInit(mm, conv<zz_p>(rInv), *ipowers, ipowers_aux, *iRb);
+  tables = sharedTables(zms, q, rt, pw, ipw);
+  context = tables->context;
+  root = tables->root;
+  rInv = tables->rInv;
 }
 
 Cmodulus& Cmodulus::operator=(const Cmodulus &other)
@@ -110,33 +207,12 @@ Cmodulus& Cmodulus::operator=(const Cmodulus &other)
   zMStar  =  other.zMStar; // Yes, really copy this pointer
   q       = other.q;
   m_inv   = other.m_inv;
-
   context = other.context;
-  zz_pBak bak; bak.save(); // backup the current modulus
-  context.restore();       // Set NTL's current modulus to q
-
-  // NOTE: newer versions of NTL allow fftRep's and zz_pXModulus's to be copied
-  // "out of context" (versions after 7.0.*). However, those copies
-  // are not intended to allow copies out of one context into another,
-  // so we still need to use copied_ptr's (but not context restoration).
-  // All of this is fairly academic, as I don't think we really
-  // copy FHEcontexts around anywhere. Also, it would be cleaner
-  // to make the vector in FHEcontext be a vector of copied_ptr<Cmodulus>
-
   root = other.root;
   rInv = other.rInv;
 
-  powers_aux = other.powers_aux;
-  ipowers_aux = other.ipowers_aux;
-
-  // copy data, not pointers in these fields
-  powers = other.powers;
-  Rb = other.Rb;
-  ipowers = other.ipowers;
-  iRb = other.iRb;
-  phimx = other.phimx;
-
-
+  // The tables are immutable, so it is safe to share them
+  tables = other.tables;
 
   return *this;
 }
@@ -146,13 +222,34 @@ void Cmodulus::FFT(vec_long &y, const ZZX& x) const
   FHE_TIMER_START;
   zz_pBak bak; bak.save();
   context.restore();
-  zz_p rt;
   zz_pX& tmp = Cmodulus::getScratch_zz_pX();
 
   conv(tmp,x);      // convert input to zpx format
+  FFT_aux(y, tmp);
+}
+
+void Cmodulus::FFT(vec_long &y, const long* x, long n) const
+{
+  FHE_TIMER_START;
+  zz_pBak bak; bak.save();
+  context.restore();
+  zz_pX& tmp = Cmodulus::getScratch_zz_pX();
+
+  tmp.rep.SetLength(n);
+  for (long i=0; i<n; i++)
+    tmp.rep[i].LoopHole() = x[i]; // DIRT: x[i] already reduced
+  tmp.normalize();
+  FFT_aux(y, tmp);
+}
+
+// The FFT of tmp, which is destroyed, the zp context must be set
+void Cmodulus::FFT_aux(vec_long &y, zz_pX& tmp) const
+{
+  zz_p rt;
   conv(rt, root);  // convert root to zp format
 
-  BluesteinFFT(tmp, getM(), rt, *powers, powers_aux, *Rb); // call the FFT routine
+  BluesteinFFT(tmp, getM(), rt, tables->powers, tables->powers_aux,
+               tables->Rb); // call the FFT routine
 
   // copy the result to the output vector y, keeping only the
   // entries corresponding to primitive roots of unity
@@ -181,11 +278,12 @@ void Cmodulus::iFFT(zz_pX &x, const vec_long& y)const
   x.normalize();
   conv(rt, rInv);  // convert rInv to zp format
 
-  BluesteinFFT(x, m, rt, *ipowers, ipowers_aux, *iRb); // call the FFT routine
+  BluesteinFFT(x, m, rt, tables->ipowers, tables->ipowers_aux,
+               tables->iRb); // call the FFT routine
 
   // reduce the result mod (Phi_m(X),q) and copy to the output polynomial x
   { FHE_NTIMER_START(iFFT_division);
-    rem(x, x, *phimx); // out %= (Phi_m(X),q)
+    rem(x, x, *tables->phimx); // out %= (Phi_m(X),q)
   }
 
   // normalize
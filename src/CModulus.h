@@ -43,6 +43,45 @@
 * roots of unity.
 **/
 
+/**
+* @class CmodTables
+* @brief The immutable per-(m,q) tables used by Cmodulus
+*
+* These depend only on m, q and the root, so all the Cmodulus objects with
+* the same (m,q,root) share a single copy, even across different FHEcontext
+* objects. The tables are kept in a process-wide registry and are released
+* when the last Cmodulus that refers to them goes away.
+**/
+class CmodTables {
+public:
+  zz_pContext   context; // NTL's tables for this modulus
+  long          root;    // 2m-th root of unity modulo q
+  long          rInv;    // root^{-1} mod q
+
+  zz_pX                powers;  // tables for forward FFT
+  Vec<mulmod_precon_t> powers_aux;
+  fftRep               Rb;
+
+  zz_pX                ipowers; // tables for backward FFT
+  Vec<mulmod_precon_t> ipowers_aux;
+  fftRep               iRb;
+
+  shared_ptr<zz_pXModulus1> phimx; // PhimX modulo q
+
+  // Build the tables for (zms.getM(), q). If rt==0 then a root is computed,
+  // relative to the NTL modulus q which is assumed to be current.
+  CmodTables(const PAlgebra& zms, const zz_pContext& cntxt, long q, long rt);
+
+  // Same, from a saved root and the powers root^{i^2} and root^{-i^2}, for
+  // i<m (see BluesteinTables), relative to the current NTL modulus q
+  CmodTables(const PAlgebra& zms, const zz_pContext& cntxt, long q, long rt,
+             const long* pw, const long* ipw);
+
+private:
+  CmodTables(const CmodTables&);            // disabled
+  CmodTables& operator=(const CmodTables&); // disabled
+};
+
 class Cmodulus {
   long          q;       // the modulus
   zz_pContext   context; // NTL's tables for this modulus
@@ -54,19 +93,10 @@ class Cmodulus {
   long        root;    // 2m-th root of unity modulo q
   long        rInv;    // root^{-1} mod q
 
-  copied_ptr<zz_pX>    powers;  // tables for forward FFT
-  Vec<mulmod_precon_t> powers_aux;
-  copied_ptr<fftRep>   Rb;
-
-  copied_ptr<zz_pX>    ipowers; // tables for backward FFT
-  Vec<mulmod_precon_t> ipowers_aux;
-  copied_ptr<fftRep>   iRb;
+  // FFT tables, shared with all other Cmodulus objects with the same (m,q)
+  shared_ptr<const CmodTables> tables;
 
-  copied_ptr<zz_pXModulus1> phimx; // PhimX modulo q, for faster division w/ remainder
-
-
-  // Allocate memory and compute roots
-  void privateInit(const PAlgebra&, long rt);
+  void FFT_aux(vec_long &y, zz_pX& tmp) const; // y = FFT(tmp), see FFT
 
  public:
 
@@ -81,6 +111,11 @@ class Cmodulus {
   // if q == 0, then the current context is used
   Cmodulus(const PAlgebra &zms, long qq, long rt);
 
+  // Specify m, q, the root and the tables of powers saved in a snapshot,
+  // see CmodTables
+  Cmodulus(const PAlgebra &zms, long qq, long rt,
+           const long* pw, const long* ipw);
+
   // Copy operator
   Cmodulus& operator=(const Cmodulus &other);
 
@@ -91,7 +126,8 @@ class Cmodulus {
   unsigned long getPhiM() const { return zMStar->getPhiM(); }
   long getQ() const          { return q; }
   long getRoot() const       { return root; }
-  const zz_pXModulus1& getPhimX() const  { return *phimx; }
+  const zz_pXModulus1& getPhimX() const  { return *tables->phimx; }
+  const CmodTables& getTables() const { return *tables; }
 
   //! @brief Restore NTL's current modulus
   void restoreModulus() const {context.restore();}
@@ -101,6 +137,9 @@ class Cmodulus {
   // sets zp context internally
   void FFT(vec_long &y, const ZZX& x) const;  // y = FFT(x)
 
+  // same as above, x holds n coefficients already reduced mod q
+  void FFT(vec_long &y, const long* x, long n) const;
+
   // expects zp context to be set externally
   void iFFT(zz_pX &x, const vec_long& y) const; // x = FFT^{-1}(y)
 
@@ -113,6 +152,9 @@ class Cmodulus {
   // DIRT: this use a couple of internal, undocumented
   // NTL interfaces
   static fftRep& getScratch_fftRep(long k);
+
+  //! @brief Number of distinct (m,q) tables currently alive in the process
+  static long sharedTablesCount();
 };
 
 
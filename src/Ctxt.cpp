@@ -17,6 +17,10 @@
 #include "Ctxt.h"
 #include "FHE.h"
 #include "timing.h"
+#ifdef FHE_CTXT_THREADS
+#include "multicore.h"
+#include <map>
+#endif
 
 #ifndef BIG_P
 // Dummy encryption, this procedure just encodes the plaintext in a Ctxt object
@@ -567,6 +571,29 @@ std::cout << "\tnoiseVar: " << noiseVar << " (" << log(noiseVar)/log(2)/2 << ")"
 }
 #endif
 
+// reLinearize does not divide by P, the product of the special primes: the
+// key-switched ciphertext is left modulo Q*P (see the disabled block at the
+// end of reLinearize). Here P and the level primes that the noise allows to
+// drop are then removed by a single modDownToSet, i.e. one scale-down and
+// one rounding pass. If *this already holds P (e.g. it was re-linearized
+// before), reLinearize would drop P alone first, so we drop it together
+// with the levels instead.
+void Ctxt::reLinearizeDown(long keyIdx)
+{
+  if (this->isEmpty()) return;
+
+  IndexSet s;
+  if (!primeSet.disjointFrom(context.specialPrimes)) {
+    findBaseSet(s); // never contains special primes
+    modDownToSet(s);
+  }
+
+  reLinearize(keyIdx); // the result is modulo Q*P
+
+  findBaseSet(s);
+  modDownToSet(s);     // the only scale-down after the key-switching
+}
+
 void Ctxt::cleanUp()
 {
   reLinearize();
@@ -1320,6 +1347,38 @@ void Ctxt::tensorProduct(const Ctxt& c1, const Ctxt& c2)
     f = rem(context.productOfPrimes(c1.primeSet),c1.ptxtSpace);
   if (f!=1) f = InvMod(f,c1.ptxtSpace);
 
+  /* Compute the noise estimate as c1.noiseVar * c2.noiseVar * factor
+   * where the factor depends on the handles of c1,c2. Specifically,
+   * if the largest powerOfS in c1,c2 are n1,n2, respectively, then we
+   * have factor = ((n1+n2) choose n2).
+   * This is done before the tensoring, since with canonical ciphertexts
+   * *this may point to c1 or c2.
+   */
+  long n1=0,  n2=0;
+  for (size_t i=0; i<c1.parts.size(); i++) // get largest powerOfS in c1
+    if (c1.parts[i].skHandle.getPowerOfS() > n1)
+      n1 = c1.parts[i].skHandle.getPowerOfS();
+  for (size_t i=0; i<c2.parts.size(); i++) // get largest powerOfS in c2
+    if (c2.parts[i].skHandle.getPowerOfS() > n2)
+      n2 = c2.parts[i].skHandle.getPowerOfS();
+
+  // compute ((n1+n2) choose n2)
+  long factor = 1;
+  for (long i=n1+1; i<=n1+n2; i++) factor *= i;
+  for (long i=n2  ; i>1     ; i--) factor /= i;
+
+  xdouble newNoiseVar
+    = c1.noiseVar * c2.noiseVar * factor * context.zMStar.get_cM();
+  if (f!=1) {
+    // WARNING: the following line is written just so to prevent overflow
+    newNoiseVar = (newNoiseVar*f)*f; // because every product was scaled by f
+  }
+
+  if (tensorCanonical(c1, c2, to_ZZ(f))) { // 3 products instead of 4
+    noiseVar = newNoiseVar;
+    return;
+  }
+
   clear();                // clear *this, before we start adding things to it
   primeSet = c1.primeSet; // set the correct prime-set before we begin
 
@@ -1344,30 +1403,7 @@ void Ctxt::tensorProduct(const Ctxt& c1, const Ctxt& c2)
 	parts.push_back(tmpPart);
     }
   }
-
-  /* Compute the noise estimate as c1.noiseVar * c2.noiseVar * factor
-   * where the factor depends on the handles of c1,c2. Specifically,
-   * if the largest powerOfS in c1,c2 are n1,n2, respectively, then we
-   * have factor = ((n1+n2) choose n2).
-   */
-  long n1=0,  n2=0;
-  for (size_t i=0; i<c1.parts.size(); i++) // get largest powerOfS in c1
-    if (c1.parts[i].skHandle.getPowerOfS() > n1)
-      n1 = c1.parts[i].skHandle.getPowerOfS();
-  for (size_t i=0; i<c2.parts.size(); i++) // get largest powerOfS in c2
-    if (c2.parts[i].skHandle.getPowerOfS() > n2)
-      n2 = c2.parts[i].skHandle.getPowerOfS();
-
-  // compute ((n1+n2) choose n2)
-  long factor = 1;
-  for (long i=n1+1; i<=n1+n2; i++) factor *= i;
-  for (long i=n2  ; i>1     ; i--) factor /= i;
-
-  noiseVar = c1.noiseVar * c2.noiseVar * factor * context.zMStar.get_cM();
-  if (f!=1) {
-    // WARNING: the following line is written just so to prevent overflow
-    noiseVar = (noiseVar*f)*f; // because every product was scaled by f
-  }
+  noiseVar = newNoiseVar;
 }
 #else
 // Create a tensor product of c1,c2. It is assumed that *this,c1,c2
@@ -1385,35 +1421,12 @@ void Ctxt::tensorProduct(const Ctxt& c1, const Ctxt& c2)
 	rem(f, context.productOfPrimes(c1.primeSet),c1.ptxtSpace);
   if (f!=1) InvMod(f,f,c1.ptxtSpace);
 
-  clear();                // clear *this, before we start adding things to it
-  primeSet = c1.primeSet; // set the correct prime-set before we begin
-
-  // The actual tensoring
-  CtxtPart tmpPart(context, IndexSet::emptySet()); // a scratch CtxtPart
-  for (size_t i=0; i<c1.parts.size(); i++) {
-	CtxtPart thisPart = c1.parts[i];
-	if (f!=1) thisPart *= f;
-	for (size_t j=0; j<c2.parts.size(); j++) {
-	  tmpPart = c2.parts[j];
-	  // What secret key will the product point to?
-	  if (!tmpPart.skHandle.mul(thisPart.skHandle, tmpPart.skHandle))
-	Error("Ctxt::tensorProduct: cannot multiply secret-key handles");
-
-	  tmpPart *= thisPart; // The element of the tensor product
-
-	  // Check if we already have a part relative to this secret-key handle
-	  long k = getPartIndexByHandle(tmpPart.skHandle);
-	  if (k >= 0) // found a matching part
-	parts[k] += tmpPart;
-	  else
-	parts.push_back(tmpPart);
-	}
-  }
-
   /* Compute the noise estimate as c1.noiseVar * c2.noiseVar * factor
    * where the factor depends on the handles of c1,c2. Specifically,
    * if the largest powerOfS in c1,c2 are n1,n2, respectively, then we
    * have factor = ((n1+n2) choose n2).
+   * This is done before the tensoring, since with canonical ciphertexts
+   * *this may point to c1 or c2.
    */
   long n1=0,  n2=0;
   for (size_t i=0; i<c1.parts.size(); i++) // get largest powerOfS in c1
@@ -1428,14 +1441,15 @@ void Ctxt::tensorProduct(const Ctxt& c1, const Ctxt& c2)
   for (long i=n1+1; i<=n1+n2; i++) factor *= i;
   for (long i=n2  ; i>1     ; i--) factor /= i;
 
-  noiseVar = c1.noiseVar * c2.noiseVar * factor * context.zMStar.get_cM();
+  xdouble newNoiseVar
+    = c1.noiseVar * c2.noiseVar * factor * context.zMStar.get_cM();
 #ifdef VERBOSE
   std::cout << "\tnoiseVar = c1.noiseVar * c2.noiseVar * factor * context.zMStar.get_cM();" << std::endl
             << "\tc1.noiseVar: " << c1.noiseVar << " (" << log(c1.noiseVar)/log(2)/2 << ")" << std::endl
             << "\tc2.noiseVar: " << c2.noiseVar << " (" << log(c2.noiseVar)/log(2)/2 << ")" << std::endl
             << "\tfactor: " << factor << std::endl
             << "\tcontext.zMStar.get_cM(): " << context.zMStar.get_cM() << std::endl
-            << "\tnoiseVar: " << noiseVar << " (" << log(noiseVar)/log(2)/2 << ")" << std::endl;
+            << "\tnoiseVar: " << newNoiseVar << " (" << log(newNoiseVar)/log(2)/2 << ")" << std::endl;
 #endif
 
   if (f!=1) {
@@ -1443,16 +1457,98 @@ void Ctxt::tensorProduct(const Ctxt& c1, const Ctxt& c2)
 	  std::cout << "f!=1" << std::endl;
 #endif
 	// WARNING: the following line is written just so to prevent overflow
-	noiseVar = (noiseVar*to_xdouble(f))*to_xdouble(f); // because every product was scaled by f
+	newNoiseVar = (newNoiseVar*to_xdouble(f))*to_xdouble(f); // because every product was scaled by f
 #ifdef VERBOSE
 	std::cout << "\tnoiseVar = (noiseVar*to_xdouble(f))*to_xdouble(f);" << std::endl
 			  << "\tto_xdouble(f): " << to_xdouble(f) << std::endl
-			  << "\tnoiseVar: " << noiseVar << " (" << log(noiseVar)/log(2)/2 << ")" << std::endl;
+			  << "\tnoiseVar: " << newNoiseVar << " (" << log(newNoiseVar)/log(2)/2 << ")" << std::endl;
 #endif
   }
+
+  if (tensorCanonical(c1, c2, f)) { // 3 products instead of 4
+    noiseVar = newNoiseVar;
+    return;
+  }
+
+  clear();                // clear *this, before we start adding things to it
+  primeSet = c1.primeSet; // set the correct prime-set before we begin
+
+  // The actual tensoring
+  CtxtPart tmpPart(context, IndexSet::emptySet()); // a scratch CtxtPart
+  for (size_t i=0; i<c1.parts.size(); i++) {
+	CtxtPart thisPart = c1.parts[i];
+	if (f!=1) thisPart *= f;
+	for (size_t j=0; j<c2.parts.size(); j++) {
+	  tmpPart = c2.parts[j];
+	  // What secret key will the product point to?
+	  if (!tmpPart.skHandle.mul(thisPart.skHandle, tmpPart.skHandle))
+	Error("Ctxt::tensorProduct: cannot multiply secret-key handles");
+
+	  tmpPart *= thisPart; // The element of the tensor product
+
+	  // Check if we already have a part relative to this secret-key handle
+	  long k = getPartIndexByHandle(tmpPart.skHandle);
+	  if (k >= 0) // found a matching part
+	parts[k] += tmpPart;
+	  else
+	parts.push_back(tmpPart);
+	}
+  }
+  noiseVar = newNoiseVar;
 }
 #endif
 
+// Tensoring of two canonical ciphertexts c1=(a0,a1), c2=(b0,b1) wrt (1,s),
+// computing (a0*b0, (a0+a1)*(b0+b1)-a0*b0-a1*b1, a1*b1) with 3 products,
+// or (a0^2, 2*a0*a1, a1^2) when c1 and c2 are the same object. Everything is
+// multiplied by f. The inputs are read before *this is modified, so *this
+// may point to c1 or c2. Returns false (and does nothing) if c1,c2 are not
+// canonical, the noise estimate is left for the caller to update.
+bool Ctxt::tensorCanonical(const Ctxt& c1, const Ctxt& c2, const ZZ& f)
+{
+  if (!c1.isCanonical() || !c2.isCanonical()) return false;
+
+  SKHandle handle; // the handle of the last part, s^2(X^t)
+  if (!handle.mul(c1.parts[1].skHandle, c2.parts[1].skHandle)) return false;
+
+  FHE_TIMER_START;
+  const CtxtPart& a0 = c1.parts[0];
+  const CtxtPart& a1 = c1.parts[1];
+  const CtxtPart& b0 = c2.parts[0];
+  const CtxtPart& b1 = c2.parts[1];
+
+  vector<CtxtPart> prod(3, CtxtPart(context, IndexSet::emptySet()));
+  prod[0] = a0;
+  prod[1] = a1;
+  prod[2] = a1;
+  if (&c1 == &c2) {           // squaring
+    prod[0] *= a0;            // a0^2
+    prod[1] *= a0;            // a0*a1
+    prod[1] += prod[1];       // 2*a0*a1
+    prod[2] *= a1;            // a1^2
+  }
+  else {
+    CtxtPart bSum = b0;
+    bSum += b1;               // b0+b1
+    prod[0] *= b0;            // a0*b0
+    prod[2] *= b1;            // a1*b1
+    prod[1] += a0;
+    prod[1] *= bSum;          // (a0+a1)*(b0+b1)
+    prod[1] -= prod[0];
+    prod[1] -= prod[2];       // a0*b1 + a1*b0
+  }
+  if (f!=1)
+    for (long i=0; i<3; i++) prod[i] *= f;
+
+  prod[0].skHandle.setOne();
+  prod[1].skHandle = c1.parts[1].skHandle;
+  prod[2].skHandle = handle;
+
+  primeSet = c1.primeSet;     // may be a self-assignment
+  parts.swap(prod);
+  return true;
+}
+
 long Ctxt::uselessPrimes(FHESecKey& secretKey, ZZX& m)
 {
 	IndexSet s = getPrimeSet();;
@@ -1511,10 +1607,17 @@ Ctxt& Ctxt::operator*=(const Ctxt& other)
   this->ptxtSpace = g;
   Ctxt tmpCtxt(this->pubKey, this->ptxtSpace); // a scratch ciphertext
 
+  // Canonical ciphertexts (wrt (1,s)) are tensored in place with 3 products,
+  // otherwise the product is computed in tmpCtxt and copied into *this
   if (this == &other) { // a squaring operation
     modDownToLevel(findBaseLevel());      // mod-down if needed
-    tmpCtxt.tensorProduct(*this, other);  // compute the actual product
-    tmpCtxt.noiseVar *= 2;     // a correction factor due to dependency
+    if (isCanonical())
+      tensorProduct(*this, *this);        // in place
+    else {
+      tmpCtxt.tensorProduct(*this, other);  // compute the actual product
+      *this = tmpCtxt; // copy the result into *this
+    }
+    noiseVar *= 2;     // a correction factor due to dependency
   }
   else {                // standard multiplication between two ciphertexts
     // Sanity check: same context and public key
@@ -1529,15 +1632,20 @@ Ctxt& Ctxt::operator*=(const Ctxt& other)
     modDownToLevel(lvl);
 
     // mod-DOWN other, if needed
+    const Ctxt* otherPtr = &other;
+    Ctxt tmpCtxt1(this->pubKey, this->ptxtSpace);
     if (primeSet!=other.primeSet){ // use temporary copy to mod-DOWN other
-      Ctxt tmpCtxt1 = other;
+      tmpCtxt1 = other;
       tmpCtxt1.modDownToLevel(lvl);
-      tmpCtxt.tensorProduct(*this,tmpCtxt1); // compute the actual product
+      otherPtr = &tmpCtxt1;
+    }
+    if (isCanonical() && otherPtr->isCanonical())
+      tensorProduct(*this, *otherPtr);    // in place
+    else {
+      tmpCtxt.tensorProduct(*this, *otherPtr); // compute the actual product
+      *this = tmpCtxt; // copy the result into *this
     }
-    else 
-      tmpCtxt.tensorProduct(*this, other);   // compute the actual product
   }
-  *this = tmpCtxt; // copy the result into *this
 
   FHE_TIMER_STOP;
   return *this;
@@ -1556,10 +1664,17 @@ Ctxt& Ctxt::operator*=(const Ctxt& other)
   this->ptxtSpace = g;
   Ctxt tmpCtxt(this->pubKey, this->ptxtSpace); // a scratch ciphertext
 
+  // Canonical ciphertexts (wrt (1,s)) are tensored in place with 3 products,
+  // otherwise the product is computed in tmpCtxt and copied into *this
   if (this == &other) { // a squaring operation
     modDownToLevel(findBaseLevel());      // mod-down if needed
-    tmpCtxt.tensorProduct(*this, other);  // compute the actual product
-    tmpCtxt.noiseVar *= 2;     // a correction factor due to dependency
+    if (isCanonical())
+      tensorProduct(*this, *this);        // in place
+    else {
+      tmpCtxt.tensorProduct(*this, other);  // compute the actual product
+      *this = tmpCtxt; // copy the result into *this
+    }
+    noiseVar *= 2;     // a correction factor due to dependency
   }
   else {                // standard multiplication between two ciphertexts
     // Sanity check: same context and public key
@@ -1574,15 +1689,20 @@ Ctxt& Ctxt::operator*=(const Ctxt& other)
     modDownToLevel(lvl);
 
     // mod-DOWN other, if needed
+    const Ctxt* otherPtr = &other;
+    Ctxt tmpCtxt1(this->pubKey, this->ptxtSpace);
     if (primeSet!=other.primeSet){ // use temporary copy to mod-DOWN other
-      Ctxt tmpCtxt1 = other;
+      tmpCtxt1 = other;
       tmpCtxt1.modDownToLevel(lvl);
-      tmpCtxt.tensorProduct(*this,tmpCtxt1); // compute the actual product
+      otherPtr = &tmpCtxt1;
+    }
+    if (isCanonical() && otherPtr->isCanonical())
+      tensorProduct(*this, *otherPtr);    // in place
+    else {
+      tmpCtxt.tensorProduct(*this, *otherPtr); // compute the actual product
+      *this = tmpCtxt; // copy the result into *this
     }
-    else
-      tmpCtxt.tensorProduct(*this, other);   // compute the actual product
   }
-  *this = tmpCtxt; // copy the result into *this
 
   FHE_TIMER_STOP;
   return *this;
@@ -1673,6 +1793,15 @@ void Ctxt::multiplyBy(const Ctxt& other)
 //FIXME: The must magic number is 42
 //  noiseVar *= xexp(2*700);
 }
+void Ctxt::multiplyBy(const Ctxt& other, bool modDown)
+{
+  if (!modDown) { multiplyBy(other); return; }
+
+  // Special case: if *this is empty then do nothing
+  if (this->isEmpty()) return;
+  *this *= other;    // perform the multiplication
+  reLinearizeDown(); // re-linearize and mod-switch in one scale-down
+}
 void Ctxt::multiplyBy2(const Ctxt& other1, const Ctxt& other2)
 {
   // Special case: if *this is empty then do nothing
@@ -2131,22 +2260,549 @@ void incrementalProduct(vector<Ctxt>& v)
   if (n > 0) recursiveIncrementalProduct(&v[0], n); // do the actual work
 }
 
+// Add a*b to *this. The product is computed with the lower-level *=
+// operator, so it is still relative to (1,s,s^2) when it is accumulated.
+void Ctxt::addProduct(const Ctxt& a, const Ctxt& b, bool negative)
+{
+  Ctxt tmp = a;
+  if (&a == &b) tmp *= tmp; // squaring, keep the dependency correction
+  else          tmp *= b;
+
+  if (this->isEmpty()) {
+    *this = tmp;
+    if (negative) negate();
+  }
+  else addCtxt(tmp, negative);
+}
+
+PreparedCtxt::PreparedCtxt(const Ctxt& c): ctxt(c), source(&c)
+{
+  level = ctxt.findBaseLevel();
+  ctxt.modDownToLevel(level);
+  if (!ctxt.isCanonical()) return;
+
+  // The factor f of the tensor product, as in Ctxt::tensorProduct
+  ZZ f(1), P;
+  P = ctxt.ptxtSpace;
+  if (P>2) rem(f, ctxt.context.productOfPrimes(ctxt.primeSet), P);
+  if (f!=1) InvMod(f, f, P);
+
+  scaled.resize(3, CtxtPart(ctxt.context, IndexSet::emptySet()));
+  scaled[0] = ctxt.parts[0];
+  scaled[1] = ctxt.parts[1];
+  if (f!=1) {
+    scaled[0] *= f;
+    scaled[1] *= f;
+  }
+  scaled[2] = scaled[0];
+  scaled[2] += scaled[1];
+
+  // factor ((1+1) choose 1) = 2 for two canonical ciphertexts
+  noiseFactor = ctxt.noiseVar * 2 * ctxt.context.zMStar.get_cM();
+  if (f!=1) noiseFactor = (noiseFactor*to_xdouble(f))*to_xdouble(f);
+}
+
+Ctxt& Ctxt::operator*=(const PreparedCtxt& other)
+{
+  // Special case: if *this is empty then do nothing
+  if (this->isEmpty()) return *this;
+
+  const Ctxt& c1 = other.ctxt;
+  assert (&context==&c1.context && &pubKey==&c1.pubKey);
+
+  // Use the prepared parts only if *this can be brought to their level,
+  // otherwise multiply by the copy c1. This is not seen as a squaring, so
+  // the dependency factor is applied here, as on the fast path below.
+  bool squaring = (this == other.source);
+  if (other.scaled.empty() || findBaseLevel() < other.level) {
+    *this *= c1;
+    if (squaring) noiseVar *= 2;
+    return *this;
+  }
+  modDownToLevel(other.level);
+
+  SKHandle handle; // the handle of the last part, s^2(X^t)
+  if (primeSet != c1.primeSet || !isCanonical()
+      || !handle.mul(c1.parts[1].skHandle, parts[1].skHandle)) {
+    *this *= c1;
+    if (squaring) noiseVar *= 2;
+    return *this;
+  }
+
+  FHE_TIMER_START;
+#ifndef BIG_P
+  ptxtSpace = GCD(ptxtSpace, c1.ptxtSpace);
+#else
+  GCD(ptxtSpace, ptxtSpace, c1.ptxtSpace);
+#endif
+  assert (ptxtSpace>1);
+
+  vector<CtxtPart> prod(3, CtxtPart(context, IndexSet::emptySet()));
+  CtxtPart bSum = parts[0];
+  bSum += parts[1];                  // b0+b1
+  prod[0] = other.scaled[0];
+  prod[0] *= parts[0];               // f*a0*b0
+  prod[2] = other.scaled[1];
+  prod[2] *= parts[1];               // f*a1*b1
+  prod[1] = other.scaled[2];
+  prod[1] *= bSum;                   // f*(a0+a1)*(b0+b1)
+  prod[1] -= prod[0];
+  prod[1] -= prod[2];                // f*(a0*b1 + a1*b0)
+
+  prod[0].skHandle.setOne();
+  prod[1].skHandle = c1.parts[1].skHandle;
+  prod[2].skHandle = handle;
+  parts.swap(prod);
+
+  noiseVar *= other.noiseFactor;
+  if (squaring) noiseVar *= 2; // dependency, as for squaring
+  FHE_TIMER_STOP;
+  return *this;
+}
+
+void Ctxt::addProduct(const PreparedCtxt& a, const Ctxt& b, bool negative)
+{
+  Ctxt tmp = b;
+  tmp *= a;
+  if (&b == a.source) tmp.noiseVar *= 2; // a squaring
+
+  if (this->isEmpty()) {
+    *this = tmp;
+    if (negative) negate();
+  }
+  else addCtxt(tmp, negative);
+}
+
+CtxtView::CtxtView(const Ctxt& c):
+  context(&c.context), pubKey(&c.pubKey), primeSet(c.primeSet),
+  ptxtSpace(c.ptxtSpace), noiseVar(c.noiseVar)
+{
+  for (size_t i=0; i<c.parts.size(); i++)
+    parts.push_back(CtxtPartView(c.parts[i]));
+}
+
+#ifndef BIG_P
+CtxtView::CtxtView(const FHEPubKey& pk, const IndexSet& _primeSet,
+                   long _ptxtSpace, const xdouble& _noiseVar,
+                   const vector<CtxtPartView>& _parts):
+#else
+CtxtView::CtxtView(const FHEPubKey& pk, const IndexSet& _primeSet,
+                   const ZZ& _ptxtSpace, const xdouble& _noiseVar,
+                   const vector<CtxtPartView>& _parts):
+#endif
+  context(&pk.getContext()), pubKey(&pk), primeSet(_primeSet),
+  ptxtSpace(_ptxtSpace), noiseVar(_noiseVar), parts(_parts)
+{
+  for (size_t i=0; i<parts.size(); i++)
+    if (&parts[i].getContext() != context
+        || parts[i].getIndexSet() != primeSet)
+      Error("CtxtView: the parts do not match the primeSet");
+}
+
+void CtxtView::copyTo(Ctxt& c) const
+{
+  assert (&c.pubKey == pubKey);
+  c.primeSet = primeSet;
+  c.ptxtSpace = ptxtSpace;
+  c.noiseVar = noiseVar;
+  c.parts.resize(parts.size(), CtxtPart(*context, IndexSet::emptySet()));
+  for (size_t i=0; i<parts.size(); i++) {
+    DoubleCRT& poly = c.parts[i]; // CtxtPart hides operator=(DoubleCRTView)
+    poly = parts[i];
+    c.parts[i].skHandle = parts[i].skHandle;
+  }
+}
+
+void Ctxt::addCtxt(const CtxtView& other, bool negative)
+{
+  // Sanity check: same context and public key
+  assert (&context==other.context && &pubKey==other.pubKey);
+
+  if (this->isEmpty()) {
+    other.copyTo(*this);
+    if (negative) negate();
+    return;
+  }
+  if (primeSet != other.primeSet) { // need to mod-UP, use a copy of the view
+    Ctxt tmp(pubKey);
+    other.copyTo(tmp);
+    addCtxt(tmp, negative);
+    return;
+  }
+
+#ifndef BIG_P
+  ptxtSpace = GCD(ptxtSpace, other.ptxtSpace);
+#else
+  GCD(ptxtSpace, ptxtSpace, other.ptxtSpace);
+#endif
+  assert (ptxtSpace>1);
+
+  for (size_t i=0; i<other.parts.size(); i++) {
+    const CtxtPartView& part = other.parts[i];
+    long j = getPartIndexByHandle(part.skHandle);
+    if (j>=0) { // found a matching part, add them up
+      if (negative) parts[j] -= part;
+      else          parts[j] += part;
+    } else {    // no mathing part found, append a copy of this part
+      parts.push_back(CtxtPart(context, IndexSet::emptySet(), part.skHandle));
+      DoubleCRT& poly = parts.back();
+      poly = part;
+      if (negative) poly.Negate();
+    }
+  }
+  noiseVar += other.noiseVar;
+}
+
+SeededCtxt::SeededCtxt(const FHEPubKey& pk):
+  pubKey(&pk), c0(pk.getContext(), IndexSet::emptySet()), ptxtSpace(0),
+  noiseVar(to_xdouble(0.0)), keyID(0) {}
+
+void SeededCtxt::expand(Ctxt& c) const
+{
+  assert (&c.pubKey == pubKey);
+  const IndexSet& s = c0.getIndexSet();
+  c.primeSet = s;
+  c.ptxtSpace = ptxtSpace;
+  c.noiseVar = noiseVar;
+  c.parts.assign(2, CtxtPart(c.context, s));
+
+  DoubleCRT& part0 = c.parts[0]; // CtxtPart hides operator=(DoubleCRT)
+  part0 = c0;
+  { RandomState state;          // restore NTL's PRG on exit
+    c.parts[1].randomize(&seed); }
+
+  c.parts[0].skHandle.setOne();
+  c.parts[1].skHandle.setBase(keyID);
+}
+
+// Bit-packing of the coefficients of a PackedCtxt: a coefficient of nBits
+// bits is split into 64-bit chunks, which are stored LSB-first and may
+// straddle two words
+static void putBits(vector<unsigned long>& words, long& pos,
+                    unsigned long w, long n)
+{
+  long k = pos/64, off = pos%64;
+  words[k] |= w << off;
+  if (off + n > 64) words[k+1] |= w >> (64-off);
+  pos += n;
+}
+
+static unsigned long getBits(const vector<unsigned long>& words, long& pos,
+                             long n)
+{
+  long k = pos/64, off = pos%64;
+  unsigned long w = words[k] >> off;
+  if (off + n > 64) w |= words[k+1] << (64-off);
+  if (n < 64) w &= (1UL << n) - 1;
+  pos += n;
+  return w;
+}
+
+static void putCoeff(vector<unsigned long>& words, long& pos, const ZZ& c,
+                     long nBits, vector<unsigned char>& buf)
+{
+  BytesFromZZ(&buf[0], c, buf.size());
+  for (long l = 0; l < nBits; l += 64) {
+    unsigned long w = 0;
+    for (long b = 7; b >= 0; b--) w = (w << 8) | buf[l/8 + b];
+    putBits(words, pos, w, min(64L, nBits-l));
+  }
+}
+
+static void getCoeff(ZZ& c, const vector<unsigned long>& words, long& pos,
+                     long nBits, vector<unsigned char>& buf)
+{
+  for (long l = 0; l < nBits; l += 64) {
+    unsigned long w = getBits(words, pos, min(64L, nBits-l));
+    for (long b = 0; b < 8; b++, w >>= 8) buf[l/8 + b] = w & 0xff;
+  }
+  ZZFromBytes(c, &buf[0], buf.size());
+}
+
+// The noise after switching from Q to Q' is about noise*Q'/Q plus the
+// rounding term of modSwitchAddedNoiseVar, so Q' is taken as the largest
+// odd number of b bits coprime to p, for the smallest b that leaves
+// marginBits bits between the noise and Q'/2. The rounding is corrected
+// as in scaleDownToSet so that the plaintext is only multiplied by Q'/Q
+// mod p, which Decrypt undoes.
+void Ctxt::squashForTransport(PackedCtxt& out, long marginBits) const
+{
+  FHE_TIMER_START;
+  assert (&pubKey == out.pubKey);
+  if (!isCanonical() || !parts[1].skHandle.isBase(-1))
+    Error("Ctxt::squashForTransport: ciphertext must be relinearized");
+
+  const ZZ& Q = context.productOfPrimes(primeSet);
+  double logQ = context.logOfProduct(primeSet)/log(2.0);
+  xdouble addedNoiseVar = modSwitchAddedNoiseVar();
+
+  long nBits = 2;
+  for (;; nBits++) {
+    if (nBits >= logQ)
+      Error("Ctxt::squashForTransport: noise too large for the margin");
+    xdouble ratio = xexp((nBits - logQ)*log(2.0));
+    xdouble var = noiseVar*ratio*ratio + addedNoiseVar;
+    if (log(var)/(2*log(2.0)) + marginBits + 1 <= nBits) break;
+  }
+
+  ZZ P, Qp, ratioModP;
+  P = ptxtSpace;
+  Qp = power2_ZZ(nBits) - 1;
+  while (GCD(Qp, P) != 1) Qp -= 2;
+  InvMod(ratioModP, Q % P, P);
+  MulMod(ratioModP, ratioModP, Qp % P, P);
+
+  long phim = context.zMStar.getPhiM();
+  out.modulus = Qp;
+  out.ptxtSpace = ptxtSpace;
+  out.keyID = parts[1].skHandle.getSecretKeyID();
+  out.nBits = nBits;
+  out.words.assign((2*phim*nBits + 63)/64, 0);
+
+  vector<unsigned char> buf(8*((nBits+63)/64));
+  ZZ Q2, t, r, target, delta;
+  ZZX poly;
+  mul(Q2, Q, 2);
+  long pos = 0;
+  for (long i = 0; i < 2; i++) {
+    parts[i].toPoly(poly);  // coefficients in (-Q/2,Q/2]
+    for (long j = 0; j < phim; j++) {
+      const ZZ& c = coeff(poly, j);
+      mul(t, c, Qp);        // r = round(c*Q'/Q)
+      LeftShift(t, t, 1);
+      add(t, t, Q);
+      div(r, t, Q2);
+
+      // add a small delta so that r = c*Q'/Q mod p
+      MulMod(target, c % P, ratioModP, P);
+      SubMod(delta, target, r % P, P);
+      if (2*delta > P) delta -= P;
+      r += delta;
+
+      rem(r, r, Qp);        // in [0,Q')
+      putCoeff(out.words, pos, r, nBits, buf);
+    }
+  }
+  FHE_TIMER_STOP;
+}
+
+void PackedCtxt::unpack(ZZX& c0, ZZX& c1) const
+{
+  long phim = pubKey->getContext().zMStar.getPhiM();
+  vector<unsigned char> buf(8*((nBits+63)/64));
+  long pos = 0;
+  ZZX* c[2] = { &c0, &c1 };
+  for (long i = 0; i < 2; i++) {
+    c[i]->rep.SetLength(phim);
+    for (long j = 0; j < phim; j++)
+      getCoeff(c[i]->rep[j], words, pos, nBits, buf);
+    c[i]->normalize();
+  }
+}
+
+Ctxt& Ctxt::operator*=(const CtxtView& other)
+{
+  // Special case: if *this is empty then do nothing
+  if (this->isEmpty()) return *this;
+  assert (&context==other.context && &pubKey==other.pubKey);
+
+  // The view cannot be mod-switched, so *this is brought down to its primes
+  if (other.primeSet <= primeSet) modDownToSet(other.primeSet);
+  if (primeSet != other.primeSet) { // fall back on a copy of the view
+    Ctxt tmp(pubKey);
+    other.copyTo(tmp);
+    return (*this *= tmp);
+  }
+
+  FHE_TIMER_START;
+#ifndef BIG_P
+  ptxtSpace = GCD(ptxtSpace, other.ptxtSpace);
+#else
+  GCD(ptxtSpace, ptxtSpace, other.ptxtSpace);
+#endif
+  assert (ptxtSpace>1);
+  tensorProduct(*this, other);
+  FHE_TIMER_STOP;
+  return *this;
+}
+
+// Same as tensorProduct(c1,c2), with the parts of c2 read in place. The
+// product is built in a scratch vector, so *this may point to c1.
+void Ctxt::tensorProduct(const Ctxt& c1, const CtxtView& c2)
+{
+  // c1,c2 may be scaled, so multiply by the inverse scalar if needed
+  ZZ f(1), P;
+  P = c1.ptxtSpace;
+  if (P>2) rem(f, context.productOfPrimes(c1.primeSet), P);
+  if (f!=1) InvMod(f, f, P);
+
+  // The noise estimate c1.noiseVar * c2.noiseVar * ((n1+n2) choose n2)
+  long n1=0,  n2=0;
+  for (size_t i=0; i<c1.parts.size(); i++) // get largest powerOfS in c1
+    if (c1.parts[i].skHandle.getPowerOfS() > n1)
+      n1 = c1.parts[i].skHandle.getPowerOfS();
+  for (size_t i=0; i<c2.parts.size(); i++) // get largest powerOfS in c2
+    if (c2.parts[i].skHandle.getPowerOfS() > n2)
+      n2 = c2.parts[i].skHandle.getPowerOfS();
+
+  long factor = 1;
+  for (long i=n1+1; i<=n1+n2; i++) factor *= i;
+  for (long i=n2  ; i>1     ; i--) factor /= i;
+
+  xdouble newNoiseVar
+    = c1.noiseVar * c2.noiseVar * factor * context.zMStar.get_cM();
+  if (f!=1) // WARNING: written just so to prevent overflow
+    newNoiseVar = (newNoiseVar*to_xdouble(f))*to_xdouble(f);
+
+  const vector<CtxtPartView>& b = c2.parts;
+  vector<CtxtPart> prod;
+  SKHandle handle; // the handle of s^2(X^t), for canonical ciphertexts
+  if (c1.isCanonical() && c2.isCanonical()
+      && handle.mul(c1.parts[1].skHandle, b[1].skHandle)) {
+    // 3 products instead of 4, as in tensorCanonical
+    const CtxtPart& a0 = c1.parts[0];
+    const CtxtPart& a1 = c1.parts[1];
+    prod.resize(3, CtxtPart(context, IndexSet::emptySet()));
+    DoubleCRT bSum(context, IndexSet::emptySet());
+    bSum = b[0];
+    bSum += b[1];             // b0+b1
+    prod[0] = a0;
+    prod[0] *= b[0];          // a0*b0
+    prod[2] = a1;
+    prod[2] *= b[1];          // a1*b1
+    prod[1] = a0;
+    prod[1] += a1;
+    prod[1] *= bSum;          // (a0+a1)*(b0+b1)
+    prod[1] -= prod[0];
+    prod[1] -= prod[2];       // a0*b1 + a1*b0
+    if (f!=1)
+      for (long i=0; i<3; i++) prod[i] *= f;
+
+    prod[0].skHandle.setOne();
+    prod[1].skHandle = a1.skHandle;
+    prod[2].skHandle = handle;
+  }
+  else for (size_t i=0; i<c1.parts.size(); i++) {
+    CtxtPart thisPart = c1.parts[i];
+    if (f!=1) thisPart *= f;
+    for (size_t j=0; j<b.size(); j++) {
+      CtxtPart tmpPart = thisPart;
+      // What secret key will the product point to?
+      if (!tmpPart.skHandle.mul(thisPart.skHandle, b[j].skHandle))
+        Error("Ctxt::tensorProduct: cannot multiply secret-key handles");
+
+      tmpPart *= b[j]; // The element of the tensor product
+
+      // Check if we already have a part relative to this secret-key handle
+      size_t k = 0;
+      while (k<prod.size() && !(prod[k].skHandle==tmpPart.skHandle)) k++;
+      if (k<prod.size()) prod[k] += tmpPart;
+      else               prod.push_back(tmpPart);
+    }
+  }
+
+  primeSet = c1.primeSet; // may be a self-assignment
+  parts.swap(prod);
+  noiseVar = newNoiseVar;
+}
+
 // Compute the inner product of two vectors of ciphertexts, this routine uses
 // the lower-level *= operator and does only one re-linearization at the end.
 void innerProduct(Ctxt& result, const vector<Ctxt>& v1, const vector<Ctxt>& v2)
 {
   long n = min(v1.size(), v2.size());
-  if (n<=0) {
-    result.clear();
+  result.clear();
+  for (long i=0; i<n; i++)
+    result.addProduct(v1[i], v2[i]);
+  result.reLinearize();
+}
+
+// Each call runs with its own PRG stream, seeded from the PRG of the caller
+// and from the index, so the results do not depend on the number of threads
+// or on the scheduling.
+void parallelBatch(long n, const function<void(long)>& f, long nthreads)
+{
+  if (n<=0) return;
+  ZZ seed = RandomBits_ZZ(256);
+
+  auto runOne = [&](long i) {
+    RandomState state; // restores the PRG of this thread when done
+    SetSeed(seed + i);
+    f(i);
+  };
+
+#ifdef FHE_CTXT_THREADS
+  // The calls go to the shared pool, so their FFTs (with -DFHE_DCRT_THREADS)
+  // are spread over the same threads instead of oversubscribing the cores
+  ThreadPool& pool = getThreadPool();
+  if (nthreads <= 0 || nthreads > pool.getNumThreads())
+    nthreads = pool.getNumThreads();
+  if (nthreads > n) nthreads = n;
+  if (nthreads > 1) {
+    long blocksz = (n + nthreads - 1)/nthreads;
+    pool.exec((n + blocksz - 1)/blocksz, [&](long t) {
+        for (long i = blocksz*t; i < min(n, blocksz*(t+1)); i++) runOne(i);
+      } );
     return;
   }
-  result = v1[0]; result *= v2[0];
-  for (long i=1; i<n; i++) {
-    Ctxt tmp = v1[i];
-    tmp *= v2[i];
-    result += tmp;
+#endif
+  for (long i = 0; i < n; i++) runOne(i);
+}
+
+// Apply op(*dst[i], *src[i]) for all i
+template<class Op>
+static void applyPairs(const vector<Ctxt*>& dst,
+                       const vector<const Ctxt*>& src, long nthreads, Op op)
+{
+  long n = min(dst.size(), src.size());
+  parallelBatch(n, [&](long i) { op(*dst[i], *src[i]); }, nthreads);
+}
+
+void multiplyPairs(const vector<Ctxt*>& dst, const vector<const Ctxt*>& src,
+                   long nthreads)
+{
+  applyPairs(dst, src, nthreads,
+             [](Ctxt& c1, const Ctxt& c2) { c1.multiplyBy(c2); });
+}
+
+void addPairs(const vector<Ctxt*>& dst, const vector<const Ctxt*>& src,
+              long nthreads)
+{
+  applyPairs(dst, src, nthreads,
+             [](Ctxt& c1, const Ctxt& c2) { c1 += c2; });
+}
+
+void subPairs(const vector<Ctxt*>& dst, const vector<const Ctxt*>& src,
+              long nthreads)
+{
+  applyPairs(dst, src, nthreads,
+             [](Ctxt& c1, const Ctxt& c2) { c1 -= c2; });
+}
+
+// At level d, combine i+2^d into i for all the multiples i of 2^{d+1}.
+// With n not a power of two, the last element of a level may have no
+// partner, it is then carried to the next level unchanged.
+void reductionTree(long n, const function<void(long,long)>& op,
+                   long nthreads, long maxDepth)
+{
+  for (long d=0, step=1; step<n && (maxDepth<0 || d<maxDepth); d++, step*=2) {
+    long nPairs = (n + step - 1)/(2*step); // #{i : i+step<n}
+    parallelBatch(nPairs, [&](long k) {
+      long i = 2*step*k;
+      op(i, i+step);
+    }, nthreads);
   }
-  result.reLinearize();
+}
+
+void productTree(vector<Ctxt>& v, CtxtBinaryOp op, long nthreads,
+                 long maxDepth)
+{
+  reductionTree(v.size(),
+    [&](long i, long j) {
+      if (op != NULL) op(v[i], v[j]);
+      else            v[i].multiplyBy(v[j]);
+      v[j].clear(); // v[j] is not needed anymore, release its memory
+    }, nthreads, maxDepth);
 }
 
 // Compute the inner product of a ciphertext vector and a constant vector
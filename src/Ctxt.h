@@ -59,11 +59,16 @@
  * to another ciphertext wrt (1,s).
  **/ 
 
+#include <functional>
 #include "DoubleCRT.h"
 
 class KeySwitch;
 class FHEPubKey;
 class FHESecKey;
+class PreparedCtxt;
+class CtxtView;
+class SeededCtxt;
+class PackedCtxt;
 
 /**
  * @class SKHandle
@@ -219,6 +224,25 @@ public:
 istream& operator>>(istream& s, CtxtPart& p);
 ostream& operator<<(ostream& s, const CtxtPart& p);
 
+/**
+ * @class CtxtPartView
+ * @brief A read-only ciphertext part over an external buffer
+ *
+ * The polynomial is a DoubleCRTView, so the same lifetime rules apply.
+ **/
+class CtxtPartView: public DoubleCRTView {
+public:
+  SKHandle skHandle; // The secret-key polynomial corresponding to this part
+
+  CtxtPartView() {}
+  CtxtPartView(const FHEcontext& _context, const IndexSet& s,
+               const long* buf, const SKHandle& handle):
+    DoubleCRTView(_context, s, buf), skHandle(handle) {}
+
+  explicit
+  CtxtPartView(const CtxtPart& p): DoubleCRTView(p), skHandle(p.skHandle) {}
+};
+
 //! \cond FALSE (make doxygen ignore this code)
 struct ZeroCtxtLike_type {}; // used to select a constructor
 const ZeroCtxtLike_type ZeroCtxtLike = ZeroCtxtLike_type();
@@ -253,6 +277,9 @@ const ZeroCtxtLike_type ZeroCtxtLike = ZeroCtxtLike_type();
 class Ctxt {
   friend class FHEPubKey;
   friend class FHESecKey;
+  friend class PreparedCtxt;
+  friend class CtxtView;
+  friend class SeededCtxt;
 
   const FHEcontext& context; // points to the parameters of this FHE instance
   const FHEPubKey& pubKey;   // points to the public encryption key;
@@ -266,9 +293,23 @@ class Ctxt {
 
   // Create a tensor product of c1,c2. It is assumed that *this,c1,c2
   // are defined relative to the same set of primes and plaintext space,
-  // and that *this DOES NOT point to the same object as c1,c2
+  // and that *this DOES NOT point to the same object as c1,c2 (unless both
+  // of them are canonical, see isCanonical below)
   void tensorProduct(const Ctxt& c1, const Ctxt& c2);
 
+  // The tensor product of canonical ciphertexts with 3 products instead of 4,
+  // *this may point to c1 or c2. Returns false if c1,c2 are not canonical.
+  bool tensorCanonical(const Ctxt& c1, const Ctxt& c2, const ZZ& f);
+
+  // The tensor product of c1 and a view, *this may point to c1
+  void tensorProduct(const Ctxt& c1, const CtxtView& c2);
+
+  // Is this a canonical ciphertext, with one part wrt 1 and one wrt s(X^t)?
+  bool isCanonical() const {
+    return parts.size()==2 && parts[0].skHandle.isOne()
+      && parts[1].skHandle.getPowerOfS()==1;
+  }
+
   // Add/subtract a ciphertext part to/from a ciphertext. These are private
   // methods, they cannot update the noiseVar estimate so they must be called
   // from a procedure that will eventually update that estimate.
@@ -352,7 +393,27 @@ public:
   Ctxt& operator-=(const Ctxt& other) { addCtxt(other,true); return *this; }
   void addCtxt(const Ctxt& other, bool negative=false);
 
-  Ctxt& operator*=(const Ctxt& other); // Multiply by aonther ciphertext
+  // Multiply by aonther ciphertext. The result is NOT re-linearized, it
+  // keeps the part relative to s^2 until reLinearize() is called, so sums
+  // of products can be accumulated and key-switched only once.
+  Ctxt& operator*=(const Ctxt& other);
+
+  //! @brief Add (or subtract) the product a*b to *this, without
+  //! re-linearization. *this may be empty, and may alias a or b.
+  void addProduct(const Ctxt& a, const Ctxt& b, bool negative=false);
+
+  //! @brief Variants with an operand prepared once for many products, see
+  //! PreparedCtxt. Also not re-linearized.
+  Ctxt& operator*=(const PreparedCtxt& other);
+  void addProduct(const PreparedCtxt& a, const Ctxt& b, bool negative=false);
+
+  //! @brief Variants with a ciphertext held in an external buffer, see
+  //! CtxtView. The view is copied only if it has primes that *this lacks
+  //! (or lacks primes of *this, for the product). Also not re-linearized.
+  Ctxt& operator+=(const CtxtView& other) { addCtxt(other); return *this; }
+  Ctxt& operator-=(const CtxtView& other) { addCtxt(other,true); return *this; }
+  void addCtxt(const CtxtView& other, bool negative=false);
+  Ctxt& operator*=(const CtxtView& other);
   void automorph(long k); // Apply automorphism F(X) -> F(X^k) (gcd(k,m)=1)
   Ctxt& operator>>=(long k) { automorph(k); return *this; }
 
@@ -411,6 +472,9 @@ public:
 
   // Higher-level multiply routines
   void multiplyBy(const Ctxt& other);
+  //! With modDown=true, the special primes and the primes that the noise
+  //! allows to drop are removed in the same mod-switch, see reLinearizeDown
+  void multiplyBy(const Ctxt& other, bool modDown);
   void multiplyBy(const Ctxt& other, FHESecKey secretKey, ZZX m);
   void multiplyBy0(const Ctxt& other, FHESecKey secretKey, ZZX m);
 
@@ -430,7 +494,12 @@ public:
   void reducePtxtSpace(ZZ newPtxtSpace);
 
   void reLinearize(long keyIdx=0);
-          // key-switch to (1,s_i), s_i is the base key with index keyIdx
+          // key-switch to (1,s_i), s_i is the base key with index keyIdx.
+          // The result is left modulo Q*P, P is dropped by the next mod-down
+
+  void reLinearizeDown(long keyIdx=0);
+         // relinearize, then mod-switch directly to the base set, removing
+         // the special primes and the level primes with one scale-down
 
   void cleanUp();
          // relinearize, then reduce, then drop special primes 
@@ -443,6 +512,12 @@ public:
   //! @brief Estimate the added noise variance
   xdouble modSwitchAddedNoiseVar() const;
 
+  //! @brief Prepare a result to be sent back for decryption: switch to the
+  //! smallest modulus Q' (not in the chain) for which the estimated noise
+  //! is still below Q'/2^{marginBits+1}, and pack the coefficients in
+  //! log2(Q') bits each. *this must be relinearized and is not modified.
+  void squashForTransport(PackedCtxt& out, long marginBits=8) const;
+
   //! @brief Find the "natural level" of a cipehrtext.
   // Find the level such that modDown to that level makes the
   // additive term due to rounding into the dominant noise term 
@@ -540,6 +615,174 @@ public:
   ///@}
   friend istream& operator>>(istream& str, Ctxt& ctxt);
   friend ostream& operator<<(ostream& str, const Ctxt& ctxt);
+  friend void writeBinary(ostream& str, const Ctxt& ctxt);
+  friend void readBinary(BinaryInput& in, Ctxt& ctxt);
+};
+
+/**
+ * @class PreparedCtxt
+ * @brief A ciphertext prepared to be multiplied by many other ciphertexts.
+ *
+ * The operand is mod-switched once to its base level, and for a canonical
+ * ciphertext (a0,a1) the scaled parts f*a0, f*a1 and f*(a0+a1) are kept,
+ * where f = (Q mod p)^{-1} is the factor of the tensor product. A product
+ * with a canonical ciphertext at the same level then costs three DoubleCRT
+ * multiplications and no scaling. Other products fall back to operator*=.
+ **/
+class PreparedCtxt {
+  friend class Ctxt;
+
+  Ctxt ctxt;               // the operand, at its base level
+  long level;              // the level of ctxt
+  vector<CtxtPart> scaled; // f*a0, f*a1, f*(a0+a1), empty if not canonical
+  xdouble noiseFactor;     // multiplies the noiseVar of the other operand
+  const Ctxt* source;      // only compared, to detect squarings
+
+public:
+  explicit PreparedCtxt(const Ctxt& c);
+
+  const Ctxt& getCtxt() const { return ctxt; }
+  long getLevel() const { return level; }
+};
+
+/**
+ * @class CtxtView
+ * @brief A read-only ciphertext whose parts live in external buffers
+ *
+ * This is meant for large batches of input ciphertexts that are already in
+ * memory (a memory-mapped file, see readBinaryView, or residues produced by
+ * another library): they can be added to, multiplied by and decrypted
+ * without copying them into DoubleCRT objects first. The view holds
+ * CtxtPartView's, so the buffers must outlive it. Use copyTo to get a Ctxt
+ * for anything else (e.g., mod-switching or key-switching the view itself).
+ **/
+class CtxtView {
+  friend class Ctxt;
+
+  const FHEcontext* context;
+  const FHEPubKey* pubKey;
+  IndexSet primeSet;
+#ifndef BIG_P
+  long ptxtSpace;
+#else
+  ZZ ptxtSpace;
+#endif
+  xdouble noiseVar;
+  vector<CtxtPartView> parts;
+
+public:
+  //! @brief A view over the parts of c, valid until c is modified
+  explicit CtxtView(const Ctxt& c);
+
+  //! @brief A view over the given parts, each of them must be defined
+  //! relative to the primes in _primeSet
+#ifndef BIG_P
+  CtxtView(const FHEPubKey& pk, const IndexSet& _primeSet, long _ptxtSpace,
+           const xdouble& _noiseVar, const vector<CtxtPartView>& _parts);
+#else
+  CtxtView(const FHEPubKey& pk, const IndexSet& _primeSet,
+           const ZZ& _ptxtSpace, const xdouble& _noiseVar,
+           const vector<CtxtPartView>& _parts);
+#endif
+
+  const FHEcontext& getContext() const { return *context; }
+  const FHEPubKey& getPubKey() const   { return *pubKey; }
+  const IndexSet& getPrimeSet() const  { return primeSet; }
+  const xdouble& getNoiseVar() const   { return noiseVar; }
+#ifndef BIG_P
+  long getPtxtSpace() const            { return ptxtSpace; }
+#else
+  const ZZ& getPtxtSpace() const       { return ptxtSpace; }
+#endif
+  const vector<CtxtPartView>& getParts() const { return parts; }
+
+  bool isCanonical() const {
+    return parts.size()==2 && parts[0].skHandle.isOne()
+      && parts[1].skHandle.getPowerOfS()==1;
+  }
+
+  //! @brief Copy the view into c, which must have the same public key
+  void copyTo(Ctxt& c) const;
+};
+
+/**
+ * @class SeededCtxt
+ * @brief A fresh symmetric encryption in compressed form
+ *
+ * In a fresh encryption (c0,c1) under the secret key, c1 is uniformly
+ * random. FHESecKey::Encrypt(SeededCtxt&,...) generates it from a random
+ * seed of seedBits bits (as KeySwitch does with prgSeed), and only keeps
+ * the seed and c0, about half the size of the ciphertext. The receiver
+ * regenerates c1 with expand. The expansion uses NTL's PRG, so both sides
+ * must use the same version of NTL.
+ **/
+class SeededCtxt {
+  friend class FHESecKey;
+
+  const FHEPubKey* pubKey;
+  ZZ seed;      // c1 = randomize(seed)
+  DoubleCRT c0;
+#ifndef BIG_P
+  long ptxtSpace;
+#else
+  ZZ ptxtSpace;
+#endif
+  xdouble noiseVar;
+  long keyID;   // c1 is relative to s_keyID
+
+public:
+  static const long seedBits = 256;
+
+  explicit SeededCtxt(const FHEPubKey& pk);
+
+  const FHEPubKey& getPubKey() const { return *pubKey; }
+  const IndexSet& getPrimeSet() const { return c0.getIndexSet(); }
+
+  //! @brief Rebuild the ciphertext (c0,c1), c must have the same public
+  //! key. This does not change the state of NTL's PRG.
+  void expand(Ctxt& c) const;
+
+  friend void writeBinary(ostream& str, const SeededCtxt& ctxt);
+  friend void readBinary(BinaryInput& in, SeededCtxt& ctxt);
+};
+
+/**
+ * @class PackedCtxt
+ * @brief A canonical ciphertext squashed for transport
+ *
+ * Made by Ctxt::squashForTransport and decrypted by FHESecKey::Decrypt. The
+ * parts c0,c1 are kept in coefficient form modulo Q'<2^nBits, with Q'
+ * coprime to the plaintext space, and stored as 2*phi(m) bit-packed
+ * coefficients of nBits bits. It cannot be used for further computations.
+ **/
+class PackedCtxt {
+  friend class Ctxt;
+  friend class FHESecKey;
+
+  const FHEPubKey* pubKey;
+  ZZ modulus;      // Q'
+#ifndef BIG_P
+  long ptxtSpace;
+#else
+  ZZ ptxtSpace;
+#endif
+  long keyID;      // c1 is relative to s_keyID
+  long nBits;      // bits per coefficient
+  vector<unsigned long> words; // the coefficients of c0 then c1
+
+public:
+  explicit PackedCtxt(const FHEPubKey& pk):
+    pubKey(&pk), ptxtSpace(0), keyID(0), nBits(0) {}
+
+  const ZZ& getModulus() const { return modulus; }
+  long getBits() const { return nBits; }
+  long bytes() const { return 8*words.size(); }
+
+  //! @brief Recover c0,c1, with coefficients in [0,Q')
+  void unpack(ZZX& c0, ZZX& c1) const;
+
+  friend void writeBinary(ostream& str, const PackedCtxt& ctxt);
+  friend void readBinary(BinaryInput& in, PackedCtxt& ctxt);
 };
 
 inline IndexSet baseSetOf(const Ctxt& c) { 
@@ -550,13 +793,58 @@ inline IndexSet baseSetOf(const Ctxt& c) {
 //! This implementation uses depth log n and (nlog n)/2 products
 void incrementalProduct(vector<Ctxt>& v);
 
-//! Compute the inner product of two vectors of ciphertexts
+//! Compute the inner product of two vectors of ciphertexts. The products
+//! are accumulated before re-linearization, so only one key-switching
+//! operation is performed.
 void innerProduct(Ctxt& result, const vector<Ctxt>& v1, const vector<Ctxt>& v2);
 inline Ctxt innerProduct(const vector<Ctxt>& v1, const vector<Ctxt>& v2)
 { Ctxt ret(v1[0].getPubKey());
   innerProduct(ret, v1, v2); return ret; 
 }
 
+//! @brief Run f(0),...,f(n-1), concurrently when compiled with
+//! -DFHE_CTXT_THREADS, on at most nthreads threads of the pool of the library
+//! (nthreads<=0 means all of them, see setNumThreads). Each call
+//! gets its own PRG stream, so anything f samples is the same for every
+//! number of threads. The calls must not write to shared state.
+void parallelBatch(long n, const function<void(long)>& f, long nthreads=0);
+
+//! @name Batches of independent operations
+//! Set *dst[i] op= *src[i] for all i (products are re-linearized). When
+//! compiled with -DFHE_CTXT_THREADS the pairs are spread over nthreads
+//! threads as in parallelBatch. The dst[i]'s must be distinct,
+//! and dst[i] may appear in src only as src[i]. The results do not depend
+//! on the number of threads.
+///@{
+void multiplyPairs(const vector<Ctxt*>& dst, const vector<const Ctxt*>& src,
+                   long nthreads=0);
+void addPairs(const vector<Ctxt*>& dst, const vector<const Ctxt*>& src,
+              long nthreads=0);
+void subPairs(const vector<Ctxt*>& dst, const vector<const Ctxt*>& src,
+              long nthreads=0);
+///@}
+
+/**
+ * @brief A balanced reduction tree over the elements 0..n-1.
+ *
+ * At level d=0,1,..., op(i, i+2^d) is called for every multiple i of
+ * 2^{d+1} with i+2^d<n. The call must combine element i+2^d into element i,
+ * which is not used anymore after that. The calls of one level run
+ * concurrently as in multiplyPairs. The tree stops after maxDepth levels
+ * (maxDepth<0 means ceil(log2 n) levels, i.e. until everything is combined
+ * into element 0), leaving partial results in the multiples of 2^maxDepth.
+ **/
+void reductionTree(long n, const function<void(long,long)>& op,
+                   long nthreads=0, long maxDepth=-1);
+
+//! An associative operation c1 = c1 op c2 on ciphertexts
+typedef void (*CtxtBinaryOp)(Ctxt& c1, const Ctxt& c2);
+
+//! @brief Reduce v with reductionTree, using op (or multiplyBy if op is
+//! NULL). Consumed ciphertexts are cleared as soon as they are used.
+void productTree(vector<Ctxt>& v, CtxtBinaryOp op=NULL,
+                 long nthreads=0, long maxDepth=-1);
+
 //! Compute the inner product of a vectors of ciphertexts and a constant vector
 void innerProduct(Ctxt& result,
 		  const vector<Ctxt>& v1, const vector<DoubleCRT>& v2);
@@ -0,0 +1,222 @@
+/* Copyright (C) 2012,2013 IBM Corp.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+/* CtxtGraph.cpp - a task graph of ciphertext operations
+ */
+#include <sys/time.h>
+#include "CtxtGraph.h"
+#include "timing.h"
+
+static double wallTime()
+{
+  struct timeval t;
+  gettimeofday(&t, NULL);
+  return ((double)t.tv_sec) + ((double)t.tv_usec)/1000000.;
+}
+
+CtxtGraph::Node CtxtGraph::addNode(const vector<Node>& deps, const Op& op,
+                                   const Ctxt* in)
+{
+  Node n = nodes.size();
+  nodes.push_back(NodeData());
+  NodeData& d = nodes.back();
+  d.op = op;
+  d.deps = deps;
+  d.input = in;
+  d.output = NULL;
+  d.depth = 0;
+  d.time = 0.0;
+  for (size_t i = 0; i < deps.size(); i++) {
+    assert(deps[i] >= 0 && deps[i] < n); // so nodes are in topological order
+    nodes[deps[i]].users.push_back(n);
+    d.depth = max(d.depth, nodes[deps[i]].depth + 1);
+  }
+  return n;
+}
+
+CtxtGraph::Node CtxtGraph::input(const Ctxt& c)
+{
+  assert(&c.getPubKey() == &pubKey);
+  return addNode(vector<Node>(), Op(), &c);
+}
+
+void CtxtGraph::setInput(Node n, const Ctxt& c)
+{
+  assert(n >= 0 && n < lsize(nodes) && !nodes[n].op);
+  assert(&c.getPubKey() == &pubKey);
+  nodes[n].input = &c;
+}
+
+CtxtGraph::Node CtxtGraph::op(const vector<Node>& deps, const Op& f)
+{
+  return addNode(deps, f, NULL);
+}
+
+CtxtGraph::Node CtxtGraph::add(Node a, Node b)
+{
+  return op({a, b}, [](Ctxt& out, const vector<const Ctxt*>& in) {
+      out = *in[0];
+      out += *in[1];
+    });
+}
+
+CtxtGraph::Node CtxtGraph::sub(Node a, Node b)
+{
+  return op({a, b}, [](Ctxt& out, const vector<const Ctxt*>& in) {
+      out = *in[0];
+      out -= *in[1];
+    });
+}
+
+CtxtGraph::Node CtxtGraph::mul(Node a, Node b)
+{
+  return sumOfProducts(vector< pair<Node,Node> >(1, make_pair(a, b)));
+}
+
+CtxtGraph::Node
+CtxtGraph::sumOfProducts(const vector< pair<Node,Node> >& terms,
+                         bool relinearize)
+{
+  vector<Node> deps;
+  for (size_t i = 0; i < terms.size(); i++) {
+    deps.push_back(terms[i].first);
+    deps.push_back(terms[i].second);
+  }
+  return op(deps, [relinearize](Ctxt& out, const vector<const Ctxt*>& in) {
+      out.clear();
+      for (size_t i = 0; i+1 < in.size(); i += 2)
+        out.addProduct(*in[i], *in[i+1]);
+      if (relinearize) out.reLinearize();
+    });
+}
+
+CtxtGraph::Node CtxtGraph::mulByConstant(Node a, const DoubleCRT& c)
+{
+  const DoubleCRT* cp = &c;
+  return op({a}, [cp](Ctxt& out, const vector<const Ctxt*>& in) {
+      out = *in[0];
+      out.multByConstant(*cp);
+    });
+}
+
+void CtxtGraph::output(Node n, Ctxt& dst)
+{
+  assert(n >= 0 && n < lsize(nodes) && &dst.getPubKey() == &pubKey);
+  nodes[n].output = &dst;
+}
+
+long CtxtGraph::depth() const
+{
+  long d = 0;
+  for (size_t n = 0; n < nodes.size(); n++) d = max(d, nodes[n].depth);
+  return d;
+}
+
+// Called with mx locked
+Ctxt* CtxtGraph::getBuffer()
+{
+  if (!freeList.empty()) {
+    Ctxt* c = freeList.back();
+    freeList.pop_back();
+    return c;
+  }
+  buffers.push_back(shared_ptr<Ctxt>(new Ctxt(pubKey)));
+  return buffers.back().get();
+}
+
+// Run the operation of n, free the inputs that are not needed anymore and
+// append to ready the users of n that can now run
+void CtxtGraph::execute(Node n, vector<Node>& ready)
+{
+  NodeData& d = nodes[n];
+  vector<const Ctxt*> in(d.deps.size());
+  Ctxt* out;
+  { FHE_MUTEX_GUARD(mx);
+    for (size_t i = 0; i < d.deps.size(); i++) in[i] = values[d.deps[i]];
+    out = getBuffer(); }
+
+  double t = wallTime();
+  d.op(*out, in);
+  d.time = wallTime() - t;
+
+  FHE_MUTEX_GUARD(mx);
+  values[n] = out;
+  for (size_t i = 0; i < d.deps.size(); i++) {
+    Node j = d.deps[i];
+    if (--usersLeft[j] > 0) continue;
+    // the inputs of the application and the outputs are not ours to reuse
+    if (nodes[j].op && nodes[j].output == NULL)
+      freeList.push_back(const_cast<Ctxt*>(values[j]));
+  }
+  if (d.users.empty() && d.output == NULL) freeList.push_back(out); // unused
+  for (size_t i = 0; i < d.users.size(); i++)
+    if (--depsLeft[d.users[i]] == 0) ready.push_back(d.users[i]);
+}
+
+void CtxtGraph::run()
+{
+  FHE_TIMER_START;
+  long N = nodes.size();
+  values.assign(N, NULL);
+  depsLeft.resize(N);
+  usersLeft.resize(N);
+  freeList.clear();
+  for (size_t i = 0; i < buffers.size(); i++)
+    freeList.push_back(buffers[i].get());
+
+  vector<Node> ready;
+  for (Node n = 0; n < N; n++) {
+    depsLeft[n] = nodes[n].deps.size();
+    usersLeft[n] = nodes[n].users.size();
+  }
+  for (Node n = 0; n < N; n++) if (!nodes[n].op) { // the inputs are ready
+    values[n] = nodes[n].input;
+    for (size_t i = 0; i < nodes[n].users.size(); i++)
+      if (--depsLeft[nodes[n].users[i]] == 0) ready.push_back(nodes[n].users[i]);
+  }
+
+#ifdef FHE_CTXT_THREADS
+  // Every operation is a job of the pool, which submits the jobs of the
+  // users it makes ready
+  ThreadPool& pool = getThreadPool();
+  ThreadPool::TaskGroup group;
+  function<void(Node)> schedule = [&](Node n) {
+    pool.submit(group, [&, n]() {
+        vector<Node> next;
+        execute(n, next);
+        for (size_t i = 0; i < next.size(); i++) schedule(next[i]);
+      });
+  };
+  for (size_t i = 0; i < ready.size(); i++) schedule(ready[i]);
+  pool.wait(group);
+#else
+  // Sequential: the nodes were declared in topological order
+  for (Node n = 0; n < N; n++) if (nodes[n].op) execute(n, ready);
+#endif
+
+  for (Node n = 0; n < N; n++)
+    if (nodes[n].output != NULL) *nodes[n].output = *values[n];
+
+  // The critical path, from the measured times
+  vector<double> finish(N, 0.0);
+  critical = work = 0.0;
+  for (Node n = 0; n < N; n++) {
+    for (size_t i = 0; i < nodes[n].deps.size(); i++)
+      finish[n] = max(finish[n], finish[nodes[n].deps[i]]);
+    finish[n] += nodes[n].time;
+    critical = max(critical, finish[n]);
+    work += nodes[n].time;
+  }
+}
@@ -0,0 +1,129 @@
+/* Copyright (C) 2012,2013 IBM Corp.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef _CtxtGraph_H_
+#define _CtxtGraph_H_
+/**
+ * @file CtxtGraph.h
+ * @brief A task graph of ciphertext operations
+ *
+ * The application declares the operations of a circuit and the ciphertexts
+ * they depend on, then calls run(). When compiled with -DFHE_CTXT_THREADS
+ * the operations whose inputs are ready run concurrently on the pool of
+ * the library (see multicore.h), otherwise they run one at a time in the
+ * order they were declared. The result of an operation is freed as soon as
+ * its last user is done, and its ciphertext is reused for a later result,
+ * so the number of ciphertexts allocated is the width of the circuit
+ * rather than its size.
+ *
+ * Typical usage:
+ * \code
+ *   CtxtGraph g(publicKey);
+ *   CtxtGraph::Node a = g.input(ca), b = g.input(cb);
+ *   CtxtGraph::Node ab = g.mul(a, b);
+ *   g.output(g.add(ab, a), result);
+ *   g.run();
+ * \endcode
+ **/
+#include "FHE.h"
+
+class CtxtGraph {
+public:
+  typedef long Node;
+
+  //! An operation sets out from its inputs, out may hold a stale value
+  typedef function<void(Ctxt& out, const vector<const Ctxt*>& in)> Op;
+
+private:
+  struct NodeData {
+    Op op;              // empty for inputs
+    vector<Node> deps;  // the inputs of op
+    vector<Node> users; // the nodes that depend on this one
+    const Ctxt* input;  // for inputs
+    Ctxt* output;       // where to copy the result, if any
+    long depth;         // operations on the longest path to this node
+    double time;        // measured time of op (seconds)
+  };
+
+  const FHEPubKey& pubKey;
+  vector<NodeData> nodes;
+
+  // The state of run()
+  vector<const Ctxt*> values; // the result of every node
+  vector<long> depsLeft;      // inputs not computed yet
+  vector<long> usersLeft;     // users not done yet
+  vector< shared_ptr<Ctxt> > buffers; // all the ciphertexts allocated
+  vector<Ctxt*> freeList;     // those that can be reused
+  FHE_MUTEX_TYPE mx;          // protects all of the above
+
+  double critical;            // measured critical path (seconds)
+  double work;                // sum of the measured times (seconds)
+
+  Node addNode(const vector<Node>& deps, const Op& op, const Ctxt* in);
+  Ctxt* getBuffer();
+  void execute(Node n, vector<Node>& ready);
+
+public:
+  explicit CtxtGraph(const FHEPubKey& pk): pubKey(pk), critical(0), work(0) {}
+
+  //! @brief A ciphertext given by the application, it is not copied and
+  //! must not change until run() returns
+  Node input(const Ctxt& c);
+
+  //! @brief Bind the input node n to another ciphertext, for the next runs
+  void setInput(Node n, const Ctxt& c);
+
+  //! @brief A general operation on the results of deps
+  Node op(const vector<Node>& deps, const Op& f);
+
+  Node add(Node a, Node b);
+  Node sub(Node a, Node b);
+
+  //! @brief The product a*b, re-linearized
+  Node mul(Node a, Node b);
+
+  //! @brief The sum of the products a_i*b_i, accumulated before a single
+  //! re-linearization, or none if relinearize=false (see Ctxt::addProduct)
+  Node sumOfProducts(const vector< pair<Node,Node> >& terms,
+                     bool relinearize=true);
+
+  //! @brief The product by a constant, which must outlive run()
+  Node mulByConstant(Node a, const DoubleCRT& c);
+
+  //! @brief Copy the result of n to dst at the end of run(). dst may be
+  //! one of the inputs. Calling it again for n replaces dst.
+  void output(Node n, Ctxt& dst);
+
+  //! @brief Evaluate the graph. It can be run again with new inputs (see
+  //! setInput), the ciphertexts of the intermediate results are kept
+  //! from one run to the next.
+  void run();
+
+  //! @name Statistics
+  ///@{
+  long size() const { return nodes.size(); }
+  //! The number of operations on the longest path
+  long depth() const;
+  //! The number of ciphertexts allocated by the last run
+  long numBuffers() const { return buffers.size(); }
+  //! The measured time of the longest path of the last run, a lower bound
+  //! on the running time for any number of threads
+  double criticalPath() const { return critical; }
+  //! The total time of the operations of the last run
+  double totalWork() const { return work; }
+  ///@}
+};
+
+#endif // _CtxtGraph_H_
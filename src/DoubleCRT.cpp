@@ -25,6 +25,8 @@
 #include "DoubleCRT.h"
 #include "multicore.h"
 #include "timing.h"
+#include <cstring>
+#include <atomic>
 
 #if (ALT_CRT)
 #warning "Polynomial Arithmetic Implementation in AltCRT.cpp"
@@ -32,11 +34,116 @@
 #else
 #warning "Polynomial Arithmetic Implementation in DoubleCRT.cpp"
 
+// The row pool. The state of each thread is allocated on first use and
+// freed when the thread exits; rows that are released after that (e.g. by
+// static objects destroyed late) are simply freed. By default the free list
+// of a thread is bounded by the largest number of rows it had live at once
+// (rows it took minus rows it returned), so a thread that frees rows made
+// by other threads (e.g. the results of a parallel batch) does not keep
+// more of them than it would use itself. setMaxRows sets a global bound
+// instead.
+class DCRTRowPoolState {
+public:
+  vector<vec_long> rows; // rows[0..nRows) hold pooled rows, the rest empty
+  long nRows;
+  long live, peak;       // rows taken minus rows returned, and its maximum
+  long allocated, reused;
+
+  DCRTRowPoolState(): nRows(0), live(0), peak(0), allocated(0), reused(0) {}
+
+  // move the pooled rows by swapping, resizing would copy them
+  void resize(long n) {
+    if (nRows > n) {
+      for (long i = n; i < nRows; i++) rows[i].kill();
+      nRows = n;
+    }
+    vector<vec_long> tmp(n);
+    for (long i = 0; i < nRows; i++) tmp[i].swap(rows[i]);
+    rows.swap(tmp);
+  }
+};
+
+static std::atomic<long> maxPooledRows(-1); // <0: the peak of each thread
+
+// NULL once the thread has exited
+static DCRTRowPoolState* rowPool()
+{
+  static thread_local bool exited = false;
+  struct Owner {
+    DCRTRowPoolState state;
+    ~Owner() { exited = true; }
+  };
+  if (exited) return NULL;
+  static thread_local Owner owner;
+  return &owner.state;
+}
+
+void DCRTRowPool::get(vec_long& v, long len)
+{
+  DCRTRowPoolState* pool = rowPool();
+  if (pool == NULL) { v.SetLength(len); return; }
+
+  if (++pool->live > pool->peak) pool->peak = pool->live;
+  if (pool->nRows > 0) {
+    v.swap(pool->rows[--pool->nRows]);
+    pool->reused++;
+  }
+  if (v.MaxLength() < len) pool->allocated++;
+  v.SetLength(len);
+}
+
+void DCRTRowPool::put(vec_long& v)
+{
+  DCRTRowPoolState* pool = rowPool();
+  if (pool == NULL) return;
+  pool->live--;
+  if (v.fixed() || v.MaxLength() == 0)
+    return;  // not recyclable, v will be freed
+
+  long limit = maxPooledRows.load(std::memory_order_relaxed);
+  if (limit < 0) limit = pool->peak;
+  if (pool->nRows >= limit) {
+    if (lsize(pool->rows) > limit) pool->resize(limit); // the limit went down
+    return;  // the pool is full, v will be freed
+  }
+  if (pool->nRows >= lsize(pool->rows))
+    pool->resize(min(max(2*lsize(pool->rows), 64L), limit));
+  v.swap(pool->rows[pool->nRows++]);
+}
+
+void DCRTRowPool::reset()
+{
+  DCRTRowPoolState* pool = rowPool();
+  if (pool == NULL) return;
+  pool->resize(0);
+  resetCounters();
+}
+
+void DCRTRowPool::resetCounters()
+{
+  DCRTRowPoolState* pool = rowPool();
+  if (pool == NULL) return;
+  pool->allocated = pool->reused = 0;
+}
+
+void DCRTRowPool::setMaxRows(long n)
+{
+  maxPooledRows.store(n, std::memory_order_relaxed);
+  // trim the pool of this thread now, the others on their next put
+  DCRTRowPoolState* pool = rowPool();
+  if (pool != NULL && n >= 0 && lsize(pool->rows) > n) pool->resize(n);
+}
+
+long DCRTRowPool::allocated()
+{ DCRTRowPoolState* pool = rowPool(); return pool? pool->allocated : 0; }
+long DCRTRowPool::reused()
+{ DCRTRowPoolState* pool = rowPool(); return pool? pool->reused : 0; }
+long DCRTRowPool::pooled()
+{ DCRTRowPoolState* pool = rowPool(); return pool? pool->nRows : 0; }
+
 // A threaded implementation of DoubleCRT operations
 
 #ifdef FHE_DCRT_THREADS
-const long FFTMaxThreads = 8;
-NTL_THREAD_LOCAL static MultiTask multiTask(FFTMaxThreads);
 
 static
 long MakeIndexVector(const IndexSet& s, Vec<long>& v)
@@ -61,17 +168,12 @@ void DoubleCRT::FFT(const ZZX& poly, const IndexSet& s)
   if (empty(s)) return;
 
   static thread_local Vec<long> tls_ivec;
-  static thread_local Vec<long> tls_pvec;
   Vec<long>& ivec = tls_ivec;
-  Vec<long>& pvec = tls_pvec;
 
   long icard = MakeIndexVector(s, ivec);
-  long nthreads = multiTask.SplitProblems(icard, pvec);
 
-  multiTask.exec(nthreads, 
-    [&](long index)  {
-      long first = pvec[index];
-      long last = pvec[index+1];
+  getThreadPool().exec1(icard,
+    [&](long first, long last)  {
       for (long j = first; j < last; j++) {
         long i = ivec[j];
         context.ithModulus(i).FFT(map[i], poly); 
@@ -171,6 +273,53 @@ template
 DoubleCRT& DoubleCRT::Op<DoubleCRT::SubFun>(const DoubleCRT &other, SubFun fun,
 			 bool matchIndexSets);
 
+// Same as above with matchIndexSets=true. The rows of the view cannot be
+// extended with more primes, so a copy is made only if *this has primes
+// that the view lacks.
+template<class Fun>
+DoubleCRT& DoubleCRT::Op(const DoubleCRTView &other, Fun fun)
+{
+  if (isDryRun()) return *this;
+
+  if (&context != &other.getContext())
+    Error("DoubleCRT::Op: incompatible objects");
+
+  const IndexSet& otherSet = other.getIndexSet();
+  if (!(map.getIndexSet() >= otherSet))
+    addPrimes(otherSet / map.getIndexSet());
+
+  if (!(map.getIndexSet() <= otherSet)) { // mod-up a scratch copy
+    DoubleCRT tmp(context, IndexSet());
+    tmp = other;
+    return Op(tmp, fun);
+  }
+
+  const IndexSet& s = map.getIndexSet();
+  long phim = context.zMStar.getPhiM();
+
+  for (long i = s.first(); i <= s.last(); i = s.next(i)) {
+    long pi = context.ithPrime(i);
+    long *row = map[i].elts();
+    const long *other_row = other.row(i);
+
+    for (long j = 0; j < phim; j++)
+      row[j] = fun.apply(row[j], other_row[j], pi);
+  }
+  return *this;
+}
+
+template
+DoubleCRT& DoubleCRT::Op<DoubleCRT::MulFun>(const DoubleCRTView &other,
+                                            MulFun fun);
+
+template
+DoubleCRT& DoubleCRT::Op<DoubleCRT::AddFun>(const DoubleCRTView &other,
+                                            AddFun fun);
+
+template
+DoubleCRT& DoubleCRT::Op<DoubleCRT::SubFun>(const DoubleCRTView &other,
+                                            SubFun fun);
+
 template<class Fun>
 DoubleCRT& DoubleCRT::Op(const ZZ &num, Fun fun)
 {
@@ -420,6 +569,12 @@ DoubleCRT::DoubleCRT(const FHEcontext &_context)
   }
 }
 
+DoubleCRT::DoubleCRT(const DoubleCRT& other)
+: context(other.context), map(new DoubleCRTHelper(other.context))
+{
+   *this = other;
+}
+
 DoubleCRT& DoubleCRT::operator=(const DoubleCRT& other)
 // optimized for the case of matching index sets
 {
@@ -428,22 +583,61 @@ DoubleCRT& DoubleCRT::operator=(const DoubleCRT& other)
    if (&context != &other.context) 
       Error("DoubleCRT assignment: incompatible contexts");
 
+   // match the index sets, recycling rows through the DCRTRowPool
    if (map.getIndexSet() != other.map.getIndexSet()) {
-      map = other.map; // copy the data
+      map.remove(map.getIndexSet() / other.map.getIndexSet());
+      map.insert(other.map.getIndexSet());
    }
-   else {
-      const IndexSet& s = map.getIndexSet();
-      long phim = context.zMStar.getPhiM();
-      for (long i = s.first(); i <= s.last(); i = s.next(i)) {
-         vec_long& row = map[i];
-         const vec_long& other_row = other.map[i];
-         for (long j = 0; j < phim; j++)
-            row[j] = other_row[j];
-      }
+
+   const IndexSet& s = map.getIndexSet();
+   long phim = context.zMStar.getPhiM();
+   for (long i = s.first(); i <= s.last(); i = s.next(i)) {
+      vec_long& row = map[i];
+      const vec_long& other_row = other.map[i];
+      for (long j = 0; j < phim; j++)
+         row[j] = other_row[j];
+   }
+   return *this;
+}
+
+DoubleCRT& DoubleCRT::operator=(const DoubleCRTView& view)
+{
+   if (&context != &view.getContext()) 
+      Error("DoubleCRT assignment: incompatible contexts");
+
+   const IndexSet& vs = view.getIndexSet();
+   if (map.getIndexSet() != vs) {
+      map.remove(map.getIndexSet() / vs);
+      map.insert(vs);
    }
+
+   long phim = context.zMStar.getPhiM();
+   for (long i = vs.first(); i <= vs.last(); i = vs.next(i))
+      memcpy(map[i].elts(), view.row(i), phim*sizeof(long));
    return *this;
 }
 
+DoubleCRTView::DoubleCRTView(const FHEcontext& _context, const IndexSet& s,
+                             const long* buf): context(&_context), indexSet(s)
+{
+  if (!(s <= (_context.specialPrimes | _context.ctxtPrimes)))
+    Error("DoubleCRTView: primes are not in the chain");
+
+  long phim = _context.zMStar.getPhiM();
+  if (!empty(s)) rows.assign(s.last()+1, (const long*) NULL);
+  for (long i = s.first(); i <= s.last(); i = s.next(i), buf += phim)
+    rows[i] = buf;
+}
+
+DoubleCRTView::DoubleCRTView(const DoubleCRT& d):
+  context(&d.context), indexSet(d.map.getIndexSet())
+{
+  const IndexSet& s = indexSet;
+  if (!empty(s)) rows.assign(s.last()+1, (const long*) NULL);
+  for (long i = s.first(); i <= s.last(); i = s.next(i))
+    rows[i] = d.map[i].elts();
+}
+
 #if 0
 // Copy only the primes in s \intersect other.getIndexSet()
 void DoubleCRT::partialCopy(const DoubleCRT& other, const IndexSet& _s)
@@ -561,14 +755,14 @@ FHE_TIMER_START;
 
   long phim = context.zMStar.getPhiM();
   long icard = MakeIndexVector(s1, ivec);
-  long nthreads = multiTask.SplitProblems(icard, pvec);
+  long nthreads = getThreadPool().SplitProblems(icard, pvec);
 
   remtab.SetLength(phim);
   for (long h = 0; h < phim; h++) remtab[h].SetLength(icard);
 
   tmpvec.SetLength(nthreads);
   
-  multiTask.exec(nthreads,
+  getThreadPool().exec(nthreads,
     [&](long index) {
       long first = pvec[index];
       long last = pvec[index+1];
@@ -589,7 +783,7 @@ FHE_TIMER_START;
 
   poly.rep.SetLength(phim);
 
-  nthreads = multiTask.SplitProblems(phim, pvec);
+  nthreads = getThreadPool().SplitProblems(phim, pvec);
 
   static thread_local ZZ tls_prod;
   static thread_local ZZ tls_prod_half;
@@ -633,7 +827,7 @@ FHE_TIMER_START;
     div(prod_half, prod_half, 2);
   }
   
-  multiTask.exec(nthreads,
+  getThreadPool().exec(nthreads,
     [&](long index) {
       ZZ& res = resvec[index];
       long first = pvec[index];
@@ -800,6 +994,108 @@ DoubleCRT& DoubleCRT::operator/=(const ZZ &num)
   return *this;
 }
 
+void DoubleCRT::toPolyCoeffs(vector<ZZ>& coeffs, const vector<long>& idx,
+                             bool positive) const
+{
+  FHE_TIMER_START;
+  long n = idx.size();
+  coeffs.assign(n, ZZ::zero());
+  if (isDryRun()) return;
+
+  const IndexSet& s = map.getIndexSet();
+  ZZ prod, tmpProd;
+  prod = 1;
+
+  zz_pBak bak; bak.save();
+
+  for (long i = s.first(); i <= s.last(); i = s.next(i)) {
+    long q = context.ithPrime(i);
+    context.ithModulus(i).restoreModulus();
+    zz_pX& tmp = Cmodulus::getScratch_zz_pX();
+    context.ithModulus(i).iFFT(tmp, map[i]);
+
+    for (long k = 0; k < n; k++) { // CRT only the selected coefficients
+      tmpProd = prod;
+      CRT(coeffs[k], tmpProd, rep(coeff(tmp, idx[k])), q);
+    }
+    prod *= q;
+  }
+
+  if (positive)
+    for (long k = 0; k < n; k++)
+      if (coeffs[k] < 0) coeffs[k] += prod;
+}
+
+void DoubleCRT::fromResidues(const long* coeffs, const IndexSet& s)
+{
+  FHE_TIMER_START;
+  if (map.getIndexSet() != s) {
+    map.remove(map.getIndexSet() / s);
+    map.insert(s);
+  }
+  if (isDryRun()) return;
+
+  long phim = context.zMStar.getPhiM();
+  for (long i = s.first(); i <= s.last(); i = s.next(i), coeffs += phim) {
+    long q = context.ithPrime(i);
+    for (long j = 0; j < phim; j++)
+      if (coeffs[j] < 0 || coeffs[j] >= q)
+        Error("DoubleCRT::fromResidues: residue out of range");
+    context.ithModulus(i).FFT(map[i], coeffs, phim);
+  }
+}
+
+void DoubleCRT::toResidues(long* coeffs) const
+{
+  FHE_TIMER_START;
+  const IndexSet& s = map.getIndexSet();
+  long phim = context.zMStar.getPhiM();
+  if (isDryRun()) {
+    for (long k = 0; k < card(s)*phim; k++) coeffs[k] = 0;
+    return;
+  }
+
+  zz_pBak bak; bak.save();
+  for (long i = s.first(); i <= s.last(); i = s.next(i), coeffs += phim) {
+    context.ithModulus(i).restoreModulus();
+    zz_pX& tmp = Cmodulus::getScratch_zz_pX();
+    context.ithModulus(i).iFFT(tmp, map[i]);
+
+    long d = deg(tmp);
+    for (long j = 0; j < phim; j++)
+      coeffs[j] = (j <= d)? rep(tmp.rep[j]) : 0;
+  }
+}
+
+DoubleCRT& DoubleCRT::MulAdd(const DoubleCRT& a, const DoubleCRT& b)
+{
+  if (isDryRun()) return *this;
+  return MulAdd(a, DoubleCRTView(b));
+}
+
+DoubleCRT& DoubleCRT::MulAdd(const DoubleCRT& a, const DoubleCRTView& b)
+{
+  if (isDryRun()) return *this;
+
+  if (&context != &a.context || &context != &b.getContext())
+    Error("DoubleCRT::MulAdd: incompatible objects");
+
+  const IndexSet& s = map.getIndexSet();
+  if (!(s <= a.map.getIndexSet()) || !(s <= b.getIndexSet()))
+    Error("DoubleCRT::MulAdd: missing primes");
+
+  long phim = context.zMStar.getPhiM();
+  for (long i = s.first(); i <= s.last(); i = s.next(i)) {
+    long pi = context.ithPrime(i);
+    long *row = map[i].elts();
+    const long *arow = a.map[i].elts();
+    const long *brow = b.row(i);
+    for (long j = 0; j < phim; j++)
+      row[j] = AddMod(row[j], MulMod(arow[j], brow[j], pi), pi);
+  }
+  return *this;
+}
+
 // Small-exponent polynomial exponentiation
 void DoubleCRT::Exp(long e)
 {
@@ -1002,6 +1298,112 @@ void DoubleCRT::scaleDownToSet(const IndexSet& s, ZZ ptxtSpace)
 }
 #endif
 
+bool CompactDoubleCRT::fits(const FHEcontext& context)
+{
+  for (long i=0; i<context.numPrimes(); i++)
+    if (context.ithPrime(i) > 0xFFFFFFFFL) return false;
+  return true;
+}
+
+void CompactDoubleCRT::pack(const DoubleCRT& d)
+{
+  FHE_TIMER_START;
+  if (&context != &d.context)
+    Error("CompactDoubleCRT::pack: incompatible objects");
+
+  const IndexSet& s = d.map.getIndexSet();
+  long phim = context.zMStar.getPhiM();
+
+  map.clear();
+  map.insert(s);
+  for (long i = s.first(); i <= s.last(); i = s.next(i)) {
+    if (context.ithPrime(i) > 0xFFFFFFFFL)
+      Error("CompactDoubleCRT::pack: prime does not fit in 32 bits");
+
+    const long *in = d.map[i].elts();
+    Vec<unsigned int>& row = map[i];
+    row.SetLength(phim);
+    unsigned int *out = row.elts();
+    for (long j = 0; j < phim; j++)
+      out[j] = (unsigned int) in[j];
+  }
+}
+
+void CompactDoubleCRT::unpack(DoubleCRT& d) const
+{
+  FHE_TIMER_START;
+  if (&context != &d.context)
+    Error("CompactDoubleCRT::unpack: incompatible objects");
+
+  const IndexSet& s = map.getIndexSet();
+  long phim = context.zMStar.getPhiM();
+
+  d.map.clear();
+  d.map.insert(s);
+  for (long i = s.first(); i <= s.last(); i = s.next(i)) {
+    const unsigned int *in = map[i].elts();
+    long *out = d.map[i].elts();
+    for (long j = 0; j < phim; j++)
+      out[j] = in[j];
+  }
+}
+
+CompactDoubleCRT& CompactDoubleCRT::operator*=(const CompactDoubleCRT& other)
+{
+  if (isDryRun()) return *this;
+  if (&context != &other.context || map.getIndexSet()!=other.getIndexSet())
+    Error("CompactDoubleCRT::operator*=: incompatible objects");
+
+  const IndexSet& s = map.getIndexSet();
+  long phim = context.zMStar.getPhiM();
+
+  for (long i = s.first(); i <= s.last(); i = s.next(i)) {
+    unsigned long q = context.ithPrime(i);
+    unsigned int *a = map[i].elts();
+    const unsigned int *b = other.map[i].elts();
+    long k = NumBits(context.ithPrime(i));
+
+    if (k > 31) { // no room for the Barrett constant, use plain division
+      for (long j = 0; j < phim; j++)
+	a[j] = (unsigned int) (((unsigned long) a[j] * b[j]) % q);
+      continue;
+    }
+
+    // Barrett reduction: with mu = floor(2^{2k}/q), both t>>(k-1) and mu
+    // are below 2^32, so the estimate of t/q is computed exactly in 64 bits
+    // and is off by at most two.
+    unsigned long mu = (1UL << (2*k)) / q;
+    for (long j = 0; j < phim; j++) {
+      unsigned long t = (unsigned long) a[j] * b[j];
+      unsigned long r = t - (((t >> (k-1)) * mu) >> (k+1)) * q;
+      r = (r >= q)? r-q : r;
+      a[j] = (unsigned int) ((r >= q)? r-q : r);
+    }
+  }
+  return *this;
+}
+
+CompactDoubleCRT& CompactDoubleCRT::operator+=(const CompactDoubleCRT& other)
+{
+  if (isDryRun()) return *this;
+  if (&context != &other.context || map.getIndexSet()!=other.getIndexSet())
+    Error("CompactDoubleCRT::operator+=: incompatible objects");
+
+  const IndexSet& s = map.getIndexSet();
+  long phim = context.zMStar.getPhiM();
+
+  for (long i = s.first(); i <= s.last(); i = s.next(i)) {
+    unsigned long q = context.ithPrime(i);
+    unsigned int *a = map[i].elts();
+    const unsigned int *b = other.map[i].elts();
+    for (long j = 0; j < phim; j++) {
+      unsigned long t = (unsigned long) a[j] + b[j];
+      a[j] = (unsigned int) ((t >= q)? t-q : t);
+    }
+  }
+  return *this;
+}
+
 ostream& operator<< (ostream &str, const DoubleCRT &d)
 {
   const IndexSet& set = d.map.getIndexSet();
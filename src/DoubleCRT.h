@@ -17,7 +17,6 @@
  * @file DoubleCRT.h
  * @brief Integer polynomials (elements in the ring R_Q) in double-CRT form
  **/
-#include <thread>
 #include "NumbTh.h"
 #include "IndexMap.h"
 #include "FHEContext.h"
@@ -31,6 +30,39 @@
 #define _DoubleCRT_H_
 
 
+/**
+ * @class DCRTRowPool
+ * @brief A per-thread pool of DoubleCRT rows
+ *
+ * Rows that are released by DoubleCRT objects (when primes are removed or
+ * the object is destroyed) are kept in a free list of the current thread,
+ * and new rows are taken from that list when possible. Once the pool is
+ * warm, the arithmetic on ciphertexts does not allocate row storage. The
+ * pool grows on demand, up to the largest number of rows the thread had
+ * live at once (rows it took minus rows it returned), so this holds for any
+ * number of primes, and rows freed by a thread other than the one that made
+ * them do not pile up. The pool of a thread is freed when it exits. The
+ * counters are per thread, and are cleared by resetCounters().
+ */
+class DCRTRowPool {
+public:
+  static void get(vec_long& v, long len); // v must be empty
+  static void put(vec_long& v);           // v is left empty
+
+  //! @brief Free all the pooled rows of this thread, and the counters
+  static void reset();
+  static void resetCounters();
+
+  //! @brief Keep at most n rows in the pool of each thread (n<0: the peak
+  //! number of live rows of the thread, the default). Other threads drop
+  //! their excess rows on their next put.
+  static void setMaxRows(long n);
+
+  static long allocated(); // rows allocated since the last reset
+  static long reused();    // rows taken from the pool since the last reset
+  static long pooled();    // rows currently in the pool
+};
+
 /**
 * @class DoubleCRTHelper
 * @brief A helper class to enforce consistency within an DoubleCRTHelper object
@@ -48,7 +80,12 @@ public:
 
   /** @brief the init method ensures that all rows have the same size */
   virtual void init(vec_long& v) { 
-    v.FixLength(val); 
+    DCRTRowPool::get(v, val); 
+  }
+
+  /** @brief released rows are recycled */
+  virtual void release(vec_long& v) { 
+    DCRTRowPool::put(v); 
   }
 
   /** @brief clone allocates a new object and copies the content */
@@ -80,6 +117,8 @@ private:
  * DoubleCRT objects relative to the same context, trying to add/multiply
  * objects that have different FHEContext objects will raise an error.
  **/
+class DoubleCRTView;
+
 class DoubleCRT {
   const FHEcontext& context; // the context
   IndexMap<vec_long> map; // the data itself: if the i'th prime is in use then
@@ -121,6 +160,10 @@ class DoubleCRT {
   template<class Fun>
   DoubleCRT& Op(const ZZX &poly, Fun fun);
 
+  // Same as Op(other, fun, true), reading the rows of other in place
+  template<class Fun>
+  DoubleCRT& Op(const DoubleCRTView &other, Fun fun);
+
 public:
 
   // Constructors and assignment operators
@@ -130,7 +173,8 @@ public:
   // the context. If the coefficients of poly are larger than the product of
   // the used primes, they are effectively reduced modulo that product
 
-  // copy constructor: default
+  //! @brief Copy constructor, the rows are taken from the DCRTRowPool
+  DoubleCRT(const DoubleCRT& other);
 
   //! @brief Initializing DoubleCRT from a ZZX polynomial
   //! @param poly The ring element itself, zero if not specified
@@ -165,6 +209,9 @@ public:
   DoubleCRT& operator=(const ZZ& num);
   DoubleCRT& operator=(const long num) { *this = to_ZZ(num); return *this; }
 
+  //! @brief Copy the rows of a view, see DoubleCRTView
+  DoubleCRT& operator=(const DoubleCRTView& view);
+
   //! Get one row of a polynomial
   long getOneRow(Vec<long>& row, long idx, bool positive=false) const;
   long getOneRow(zz_pX& row, long idx) const; // This affects NTL's modulus
@@ -252,6 +299,10 @@ public:
     return Op(to_ZZ(num), AddFun());
   }
 
+  DoubleCRT& operator+=(const DoubleCRTView &other) {
+    return Op(other, AddFun());
+  }
+
   DoubleCRT& operator-=(const DoubleCRT &other) {
     return Op(other,SubFun());
   }
@@ -268,6 +319,10 @@ public:
     return Op(to_ZZ(num), SubFun());
   }
 
+  DoubleCRT& operator-=(const DoubleCRTView &other) {
+    return Op(other, SubFun());
+  }
+
   // These are the prefix versions, ++dcrt and --dcrt. 
   DoubleCRT& operator++() { return (*this += 1); };
   DoubleCRT& operator--() { return (*this -= 1); };
@@ -295,6 +350,10 @@ public:
     return Op(to_ZZ(num),MulFun());
   }
 
+  DoubleCRT& operator*=(const DoubleCRTView &other) {
+    return Op(other,MulFun());
+  }
+
 
   // Procedural equivalents, supporting also the matchIndexSets flag
   void Add(const DoubleCRT &other, bool matchIndexSets=true) {
@@ -316,6 +375,28 @@ public:
   //! @brief Small-exponent polynomial exponentiation
   void Exp(long k);
 
+  //! @brief Recover only the coefficients with the given indexes, in
+  //! symmetric representation (or in [0,Q) if positive=true). This still
+  //! takes one inverse FFT per prime, but the CRT is done only for these
+  //! coefficients.
+  void toPolyCoeffs(vector<ZZ>& coeffs, const vector<long>& idx,
+                    bool positive=false) const;
+
+  //! @brief Set *this from the residues of the coefficients of a polynomial
+  //! modulo the primes of s: coeffs holds card(s) rows of phi(m) values in
+  //! [0,p_i), in increasing order of the primes. This takes one FFT per
+  //! prime and no multi-precision arithmetic.
+  void fromResidues(const long* coeffs, const IndexSet& s);
+
+  //! @brief The converse, writes card(s) rows of phi(m) residues of the
+  //! coefficients, for the primes s of *this, one inverse FFT per prime
+  void toResidues(long* coeffs) const;
+
+  //! @brief Fused multiply-accumulate, *this += a*b in one pass. The primes
+  //! of *this must be contained in those of a and b (extra ones are ignored)
+  DoubleCRT& MulAdd(const DoubleCRT& a, const DoubleCRT& b);
+  DoubleCRT& MulAdd(const DoubleCRT& a, const DoubleCRTView& b);
+
   // Apply the automorphism F(X) --> F(X^k)  (with gcd(k,m)=1)
   void automorph(long k);
   DoubleCRT& operator>>=(long k) { automorph(k); return *this; }
@@ -393,6 +474,95 @@ public:
 
   friend ostream& operator<< (ostream &s, const DoubleCRT &d);
   friend istream& operator>> (istream &s, DoubleCRT &d);
+
+  // Binary I/O, see binio.h
+  friend void writeBinary(ostream& str, const DoubleCRT& d);
+  friend void readBinary(BinaryInput& in, DoubleCRT& d);
+
+  friend class CompactDoubleCRT;
+  friend class DoubleCRTView;
+};
+
+
+/**
+ * @class DoubleCRTView
+ * @brief A read-only DoubleCRT whose rows live in an external buffer
+ *
+ * The view does not own anything: it only records the index set and a
+ * pointer to the row of each prime, which must stay valid (and unchanged)
+ * as long as the view is used. The buffer can be a DoubleCRT object, a
+ * memory-mapped file in the binary format of binio.h, or residues computed
+ * by another library, as long as it holds one row of phi(m) residues in
+ * [0,p_i) per prime, in increasing order of the primes. A view can be used
+ * as the right-hand operand of the arithmetic operators of DoubleCRT, and
+ * is copied into a DoubleCRT by assignment when anything else is needed.
+ **/
+class DoubleCRTView {
+  const FHEcontext* context;
+  IndexSet indexSet;
+  vector<const long*> rows; // rows[i] is the row of the i'th prime, if in set
+
+public:
+  DoubleCRTView(): context(NULL) {}
+
+  //! @brief A view over buf, which holds card(s)*phi(m) residues
+  DoubleCRTView(const FHEcontext& _context, const IndexSet& s,
+                const long* buf);
+
+  //! @brief A view over the rows of d, valid until d is modified
+  explicit DoubleCRTView(const DoubleCRT& d);
+
+  const FHEcontext& getContext() const { return *context; }
+  const IndexSet& getIndexSet() const { return indexSet; }
+
+  //! @brief The row of the i'th prime, i must be in the index set
+  const long* row(long i) const { return rows[i]; }
+};
+
+
+/**
+ * @class CompactDoubleCRT
+ * @brief A DoubleCRT object whose rows are stored as 32-bit words
+ *
+ * When all the primes in the chain fit in 31 bits (e.g., when compiling
+ * with FHE_SMALL_PRIMES), the residues can be stored in half the memory.
+ * This is a storage format only: an application may pack objects that it
+ * keeps around for a long time (such as intermediate ciphertexts in a
+ * product tree) and unpack them before using them, but Ctxt, CtxtPart and
+ * the key-switching matrices still hold ordinary DoubleCRT rows, and there
+ * is no runtime storage mode. The arithmetic kernels below are scalar
+ * loops with 64-bit intermediate products, reduced with a per-prime
+ * Barrett constant (except for 32-bit primes, which fall back on %); they
+ * are used by the Storage section of Test_RSA to compare the two layouts.
+ **/
+class CompactDoubleCRT {
+  const FHEcontext& context;
+  IndexMap< Vec<unsigned int> > map;
+
+public:
+  explicit CompactDoubleCRT(const FHEcontext& _context): context(_context) {}
+  explicit CompactDoubleCRT(const DoubleCRT& d): context(d.context)
+  { pack(d); }
+
+  //! @brief Can all the primes in the chain be stored in 32-bit words?
+  static bool fits(const FHEcontext& context);
+
+  //! @brief Store a copy of d in compact form
+  void pack(const DoubleCRT& d);
+
+  //! @brief Recover the DoubleCRT object
+  void unpack(DoubleCRT& d) const;
+
+  //! @brief Pointwise multiplication and addition, computed on the compact
+  //! rows. It is assumed that other has the same index set as *this.
+  CompactDoubleCRT& operator*=(const CompactDoubleCRT& other);
+  CompactDoubleCRT& operator+=(const CompactDoubleCRT& other);
+
+  const IndexSet& getIndexSet() const { return map.getIndexSet(); }
+
+  //! @brief Size in bytes of the stored residues
+  long bytes() const
+  { return card(map.getIndexSet()) * context.zMStar.getPhiM() * 4; }
 };
 
 
@@ -27,10 +27,6 @@
 #include "timing.h"
 #include "multicore.h"
 
-#ifdef FHE_BOOT_THREADS
-extern NTL_THREAD_LOCAL MultiTask *bootTask;
-#endif
-
 
 
 class PlaintextArray; // forward reference
@@ -520,18 +520,34 @@ ZZ FHEPubKey::Encrypt(Ctxt &ctxt, const ZZX& ptxt, ZZ ptxtSpace,
 
 #ifdef BIG_P
 void FHEPubKey::NFLlib2HElib(Ctxt &ctxt, const char* file_c0, const char* file_c1, ZZ ptxtSpace) const
+{
+  ifstream file0(file_c0, ios::in);
+  ifstream file1(file_c1, ios::in);
+  ZZX c0, c1;
+  file0 >> c0;
+  file1 >> c1;
+  file0.close();
+  file1.close();
+  DoubleCRT d0(c0, context, context.ctxtPrimes);
+  DoubleCRT d1(c1, context, context.ctxtPrimes);
+  NFLlib2HElib(ctxt, d0, d1, ptxtSpace);
+}
+
+void FHEPubKey::NFLlib2HElib(Ctxt &ctxt, const DoubleCRT& c0, const DoubleCRT& c1, ZZ ptxtSpace) const
 {
 #ifdef VERBOSE
-	std::cout << "FHESecKey::Encrypt" << std::endl;
+	std::cout << "FHEPubKey::NFLlib2HElib" << std::endl;
 #endif
   FHE_TIMER_START;
   assert(((FHEPubKey*)this) == &ctxt.pubKey);
+  assert(c0.getIndexSet() == c1.getIndexSet());
+  assert(c0.getIndexSet() <= context.ctxtPrimes);
 
   if (ptxtSpace<2)
     ptxtSpace = pubEncrKey.ptxtSpace; // default plaintext space is p^r
   assert(ptxtSpace >= 2);
-  ctxt.primeSet = context.ctxtPrimes; // initialize the primeSet
-  {CtxtPart tmpPart(context, context.ctxtPrimes);
+  ctxt.primeSet = c0.getIndexSet(); // initialize the primeSet
+  {CtxtPart tmpPart(context, ctxt.primeSet);
   ctxt.parts.assign(2,tmpPart);}      // allocate space
   // Set Ctxt bookeeping parameters
   ctxt.ptxtSpace = ptxtSpace;
@@ -546,15 +562,8 @@ std::cout << "\tctxt.noiseVar = context.stdev*context.stdev * phim * to_xdouble(
           << "\tctxt.noiseVar: " << ctxt.noiseVar << " (" << log(ctxt.noiseVar)/log(2)/2 << ")" << std::endl;
 #endif
   // Make parts[0],parts[1] point to (1,s)
-  //  ctxt.parts[0].skHandle.setOne();
-  //  ctxt.parts[1].skHandle.setBase(skIdx);
-  ifstream file0(file_c0, ios::in);
-  ifstream file1(file_c1, ios::in);
-  ZZX c0, c1;
-  file0 >> c0;
-  file1 >> c1;
-  file0.close();
-  file1.close();
+  ctxt.parts[0].skHandle.setOne();
+  ctxt.parts[1].skHandle.setBase(0);
   ctxt.parts[0] += c0;
   ctxt.parts[1] += c1;
 }
@@ -733,12 +742,12 @@ long FHESecKey::ImportSecKey(const DoubleCRT& sKey, long Hwt,
   }
   skHwts.push_back(Hwt); // record the Hamming weight of the new secret-key
   sKeys.push_back(sKey); // add to the list of secret keys
+  keyCache.clear();
+  addSparseKey(sKey);
   long keyID = sKeys.size()-1; // not thread-safe?
 
-  if (!onlyLinear) {
-    GenKeySWmatrix(2,1,keyID,keyID); // At least we need the s^2 -> s matrix
-    GenKeySWmatrix(3,1,keyID,keyID); //             and also s^3 -> s
-  }
+  if (!onlyLinear) // At least we need the s^2 -> s and s^3 -> s matrices
+    GenKeySWmatrices({ make_pair(2L,1L), make_pair(3L,1L) }, keyID, keyID);
   return keyID; // return the index where this key is stored
 }
 #else
@@ -773,58 +782,100 @@ long FHESecKey::ImportSecKey(const DoubleCRT& sKey, long Hwt,
   }
   skHwts.push_back(Hwt); // record the Hamming weight of the new secret-key
   sKeys.push_back(sKey); // add to the list of secret keys
+  keyCache.clear();
+  addSparseKey(sKey);
   long keyID = sKeys.size()-1; // not thread-safe?
 
-  if (!onlyLinear) {
-    GenKeySWmatrix(2,1,keyID,keyID); // At least we need the s^2 -> s matrix
-    GenKeySWmatrix(3,1,keyID,keyID); //             and also s^3 -> s
-  }
+  if (!onlyLinear) // At least we need the s^2 -> s and s^3 -> s matrices
+    GenKeySWmatrices({ make_pair(2L,1L), make_pair(3L,1L) }, keyID, keyID);
   return keyID; // return the index where this key is stored
 }
 #endif
 
-#ifndef BIG_P
-// Generate a key-switching matrix and store it in the public key.
-// The argument p denotes the plaintext space
-void FHESecKey::GenKeySWmatrix(long fromSPower, long fromXPower,
-			       long fromIdx, long toIdx, long p)
+// Build the matrices for all the pairs (s-power, X-power) in powers. One
+// task per matrix computes s^r(X^t) and the ai's, which must be drawn in
+// order from the stream of prgSeed since this is how they are recovered when
+// key-switching. Then one task per column computes the i'th column
+// bi = p*ei - ai*s + s^r(X^t)*Q*B1*...*B{i-1}.
+template<class PT>
+void FHESecKey::buildKeySWmatrices(const vector< pair<long,long> >& powers,
+                                   long fromIdx, long toIdx, PT p,
+                                   long nthreads)
 {
   FHE_TIMER_START;
 
-  // sanity checks
-  if (fromSPower<=0 || fromXPower<=0) return;  
-  if (fromSPower==1 && fromXPower==1 && fromIdx==toIdx) return;
-
-  // See if this key-switching matrix already exists in our list
-  if (haveKeySWmatrix(fromSPower, fromXPower, fromIdx, toIdx))
-    return; // nothing to do here
+  vector<KeySwitch> mats;
+  for (long j = 0; j < lsize(powers); j++) {
+    long sPow = powers[j].first;
+    long xPow = powers[j].second;
 
-  DoubleCRT fromKey = sKeys.at(fromIdx); // copy object, not a reference
-  const DoubleCRT& toKey = sKeys.at(toIdx);   // this can be a reference
+    // sanity checks
+    if (sPow<=0 || xPow<=0) continue;
+    if (sPow==1 && xPow==1 && fromIdx==toIdx) continue;
 
-  if (fromXPower>1) fromKey.automorph(fromXPower); // compute s(X^t)
-  if (fromSPower>1) fromKey.Exp(fromSPower);       // compute s^r(X^t)
-  // SHAI: The above lines compute the automorphism and exponentiation mod q,
-  //   turns out this is really what we want (even through usually we think
-  //   of the secret key as being mod p^r)
+    // See if this key-switching matrix already exists in our list
+    if (haveKeySWmatrix(sPow, xPow, fromIdx, toIdx)) continue;
+    bool dup = false;
+    for (long k = 0; k < lsize(mats) && !dup; k++)
+      dup = (mats[k].fromKey == SKHandle(sPow, xPow, fromIdx));
+    if (dup) continue;
 
-  KeySwitch ksMatrix(fromSPower,fromXPower,fromIdx,toIdx);
-  RandomBits(ksMatrix.prgSeed, 256); // a random 256-bit seed
+    mats.push_back(KeySwitch(sPow, xPow, fromIdx, toIdx, p));
+    RandomBits(mats.back().prgSeed, 256); // a random 256-bit seed
+  }
+  long nMats = mats.size();
+  if (nMats == 0) return;
 
+  const DoubleCRT& toKey = sKeys.at(toIdx);
   long n = context.digits.size();
 
-  ksMatrix.b.resize(n, DoubleCRT(context)); // size-n vector
-
-  vector<DoubleCRT> a; 
-  a.resize(n, DoubleCRT(context));
+  // The i'th column holds a multiple of Q*B1*...*B{i-1} of the fromKey
+  vector<ZZ> factors(n);
+  for (long i = 0; i < n; i++) {
+    if (i == 0) factors[i] = context.productOfPrimes(context.specialPrimes);
+    else factors[i] = factors[i-1]*context.productOfPrimes(context.digits[i-1]);
+  }
 
-  { RandomState state;
-    SetSeed(ksMatrix.prgSeed);
-    for (long i = 0; i < n; i++) 
-      a[i].randomize();
-  } // restore state upon destruction of state
+  vector<DoubleCRT> fromKeys(nMats, sKeys.at(fromIdx));
+  parallelBatch(nMats, [&](long j) {
+      const SKHandle& from = mats[j].fromKey;
+      if (from.getPowerOfX()>1) fromKeys[j].automorph(from.getPowerOfX());
+      if (from.getPowerOfS()>1) fromKeys[j].Exp(from.getPowerOfS());
+      // SHAI: The above lines compute the automorphism and exponentiation
+      //   mod q, turns out this is really what we want (even through usually
+      //   we think of the secret key as being mod p^r)
+
+      // the pseudorandom ai's are stored in the bi's until the next batch
+      mats[j].b.resize(n, DoubleCRT(context)); // size-n vector
+      { RandomState state;
+        SetSeed(mats[j].prgSeed);
+        for (long i = 0; i < n; i++)
+          mats[j].b[i].randomize();
+      } // restore state upon destruction of state
+    }, nthreads);
+
+  // generate the RLWE instances with pseudorandom ai's, and add in the
+  // multiples of the fromKey secret key
+  parallelBatch(nMats*n, [&](long k) {
+      long j = k / n, i = k % n;
+      DoubleCRT a(mats[j].b[i]);
+      RLWE1(mats[j].b[i], a, toKey, p);
+      DoubleCRT tmp(fromKeys[j]);
+      tmp *= factors[i];
+      mats[j].b[i] += tmp;
+    }, nthreads);
+
+  // Push the new matrices onto our list
+  for (long j = 0; j < nMats; j++)
+    keySwitching.push_back(mats[j]);
+}
 
-  // Record the plaintext space for this key-switching matrix
+#ifndef BIG_P
+void FHESecKey::GenKeySWmatrices(const vector< pair<long,long> >& powers,
+                                 long fromIdx, long toIdx, long p,
+                                 long nthreads)
+{
+  // Record the plaintext space for these key-switching matrices
   if (p<2) {
     if (context.isBootstrappable()) // use larger bootstrapping plaintext space
          p = context.rcData.alMod->getPPowR();
@@ -837,93 +888,247 @@ void FHESecKey::GenKeySWmatrix(long fromSPower, long fromXPower,
   //   in case the calling application will make it bootstrappable later.
 
   assert(p>=2);
-  ksMatrix.ptxtSpace = p;
-
-  // generate the RLWE instances with pseudorandom ai's
-
-  for (long i = 0; i < n; i++) {
-    RLWE1(ksMatrix.b[i], a[i], toKey, p); 
-  }
-  // Add in the multiples of the fromKey secret key
-  fromKey *= context.productOfPrimes(context.specialPrimes);
-  for (long i = 0; i < n; i++) {
-    ksMatrix.b[i] += fromKey;
-    fromKey *= context.productOfPrimes(context.digits[i]);
-  }
+  buildKeySWmatrices(powers, fromIdx, toIdx, p, nthreads);
+}
 
-  // Push the new matrix onto our list
-  keySwitching.push_back(ksMatrix);
+// Generate a key-switching matrix and store it in the public key.
+// The argument p denotes the plaintext space
+void FHESecKey::GenKeySWmatrix(long fromSPower, long fromXPower,
+			       long fromIdx, long toIdx, long p)
+{
+  GenKeySWmatrices(vector< pair<long,long> >(1,
+                     make_pair(fromSPower, fromXPower)), fromIdx, toIdx, p);
 }
 #else
+void FHESecKey::GenKeySWmatrices(const vector< pair<long,long> >& powers,
+                                 long fromIdx, long toIdx, ZZ p,
+                                 long nthreads)
+{
+  // Record the plaintext space for these key-switching matrices
+  if (p<2) {
+    p = context.ModulusP();
+  }
+  buildKeySWmatrices(powers, fromIdx, toIdx, p, nthreads);
+}
+
 // Generate a key-switching matrix and store it in the public key.
 // The argument p denotes the plaintext space
 void FHESecKey::GenKeySWmatrix(long fromSPower, long fromXPower,
 			       long fromIdx, long toIdx, ZZ p)
 {
-  FHE_TIMER_START;
+  GenKeySWmatrices(vector< pair<long,long> >(1,
+                     make_pair(fromSPower, fromXPower)), fromIdx, toIdx, p);
+}
+#endif
 
-  // sanity checks
-  if (fromSPower<=0 || fromXPower<=0) return;
-  if (fromSPower==1 && fromXPower==1 && fromIdx==toIdx) return;
+shared_ptr<const DoubleCRT>
+SecKeyPowerCache::find(const vector<long>& id) const
+{
+  FHE_MUTEX_GUARD(mx);
+  map< vector<long>, Entry >::const_iterator it = entries.find(id);
+  if (it == entries.end()) return shared_ptr<const DoubleCRT>();
+  lru.splice(lru.begin(), lru, it->second.pos); // move to the front
+  return it->second.key;
+}
 
-  // See if this key-switching matrix already exists in our list
-  if (haveKeySWmatrix(fromSPower, fromXPower, fromIdx, toIdx))
-    return; // nothing to do here
+void SecKeyPowerCache::insert(const vector<long>& id,
+                              shared_ptr<const DoubleCRT> key)
+{
+  FHE_MUTEX_GUARD(mx);
+  long bytes = card(key->getIndexSet())
+               * key->getContext().zMStar.getPhiM() * sizeof(long);
+
+  map< vector<long>, Entry >::iterator it = entries.find(id);
+  if (it != entries.end()) { // another thread got there first
+    totalBytes -= it->second.bytes;
+    lru.erase(it->second.pos);
+    entries.erase(it);
+  }
 
-  DoubleCRT fromKey = sKeys.at(fromIdx); // copy object, not a reference
-  const DoubleCRT& toKey = sKeys.at(toIdx);   // this can be a reference
+  // An entry that is too large by itself is not cached at all
+  evict(maxBytes - bytes);
+  if (bytes > maxBytes) return;
 
-  if (fromXPower>1) fromKey.automorph(fromXPower); // compute s(X^t)
-  if (fromSPower>1) fromKey.Exp(fromSPower);       // compute s^r(X^t)
-  // SHAI: The above lines compute the automorphism and exponentiation mod q,
-  //   turns out this is really what we want (even through usually we think
-  //   of the secret key as being mod p^r)
+  lru.push_front(id);
+  Entry& e = entries[id];
+  e.key = key;
+  e.bytes = bytes;
+  e.pos = lru.begin();
+  totalBytes += bytes;
+}
 
-  KeySwitch ksMatrix(fromSPower,fromXPower,fromIdx,toIdx);
-  RandomBits(ksMatrix.prgSeed, 256); // a random 256-bit seed
+void SecKeyPowerCache::clear()
+{
+  FHE_MUTEX_GUARD(mx);
+  entries.clear();
+  lru.clear();
+  totalBytes = 0;
+}
 
-  long n = context.digits.size();
+long SecKeyPowerCache::size() const
+{
+  FHE_MUTEX_GUARD(mx);
+  return entries.size();
+}
 
-  ksMatrix.b.resize(n, DoubleCRT(context)); // size-n vector
+long SecKeyPowerCache::bytes() const
+{
+  FHE_MUTEX_GUARD(mx);
+  return totalBytes;
+}
 
-  vector<DoubleCRT> a;
-  a.resize(n, DoubleCRT(context));
+void SecKeyPowerCache::setMaxBytes(long n)
+{
+  FHE_MUTEX_GUARD(mx);
+  maxBytes = n;
+  evict(maxBytes);
+}
 
-  { RandomState state;
-    SetSeed(ksMatrix.prgSeed);
-    for (long i = 0; i < n; i++)
-      a[i].randomize();
-  } // restore state upon destruction of state
+// Drop the least recently used entries until at most limit bytes remain.
+// The caller holds the lock.
+void SecKeyPowerCache::evict(long limit)
+{
+  while (!lru.empty() && totalBytes > limit) {
+    map< vector<long>, Entry >::iterator it = entries.find(lru.back());
+    totalBytes -= it->second.bytes;
+    entries.erase(it);
+    lru.pop_back();
+  }
+}
 
-  // Record the plaintext space for this key-switching matrix
+// The cache entries are identified by (keyID, powerOfS, powerOfX, primes)
+shared_ptr<const DoubleCRT>
+FHESecKey::keyPower(const SKHandle& handle, const IndexSet& s) const
+{
+  long keyIdx = handle.getSecretKeyID();
+  long xPower = handle.getPowerOfX();
+  long sPower = handle.getPowerOfS();
+
+  vector<long> id;
+  id.push_back(keyIdx);
+  id.push_back(sPower);
+  id.push_back(xPower);
+  for (long i = s.first(); i <= s.last(); i = s.next(i)) id.push_back(i);
+
+  shared_ptr<const DoubleCRT> cached = keyCache.find(id);
+  if (cached) return cached;
+
+  DoubleCRT* key = new DoubleCRT(sKeys.at(keyIdx)); // copy the key
+  key->removePrimes(key->getIndexSet() / s); // drop extra primes, for efficiency
+  if (xPower>1) key->automorph(xPower);       // s(X^t)
+  if (sPower>1) key->Exp(sPower);             // s^r(X^t)
+
+  shared_ptr<const DoubleCRT> ret(key);
+  keyCache.insert(id, ret);
+  return ret;
+}
 
-  if (p<2) {
-    p = context.ModulusP();
-  }
+// For each ciphertext part, fetch the (cached) key and multiply-accumulate
+void FHESecKey::decryptDCRT(DoubleCRT& ptxt, const Ctxt &ciphertxt) const
+{
+  decryptDCRT(ptxt, CtxtView(ciphertxt));
+}
 
-  // FIXME: We use context.isBootstrappable() rather than
-  //   this->isBootstrappable(). So we get the larger bootstrapping
-  //   plaintext space even if *this is not currently bootstrapppable,
-  //   in case the calling application will make it bootstrappable later.
+void FHESecKey::decryptDCRT(DoubleCRT& ptxt, const CtxtView &ciphertxt) const
+{
+  assert(getContext()==ciphertxt.getContext());
+  const IndexSet& ptxtPrimes = ciphertxt.getPrimeSet();
+  assert(ptxt.getIndexSet()==ptxtPrimes);
 
-  ksMatrix.ptxtSpace = p;
+  const vector<CtxtPartView>& parts = ciphertxt.getParts();
+  for (size_t i=0; i<parts.size(); i++) {
+    const CtxtPartView& part = parts[i];
+    if (part.skHandle.isOne()) { // No need to multiply
+      ptxt += part;
+      continue;
+    }
+    ptxt.MulAdd(*keyPower(part.skHandle, ptxtPrimes), part);
+  }
+}
 
-  // generate the RLWE instances with pseudorandom ai's
+void FHESecKey::decryptPoly(ZZX& f, const Ctxt &ciphertxt) const
+{
+  DoubleCRT ptxt(context, ciphertxt.primeSet);
+  decryptDCRT(ptxt, ciphertxt);
+  ptxt.toPoly(f); // convert to coefficient representation
+}
 
-  for (long i = 0; i < n; i++) {
-    RLWE1(ksMatrix.b[i], a[i], toKey, p);
+// Same as Decrypt, but the CRT, the scaling by Q^{-1} mod p and the
+// reduction mod p are only applied to the selected coefficients
+void FHESecKey::DecryptCoeffs(vector<ZZ>& coeffs, const Ctxt &ciphertxt,
+                              const vector<long>& idx) const
+{
+  FHE_TIMER_START;
+  DoubleCRT ptxt(context, ciphertxt.primeSet);
+  decryptDCRT(ptxt, ciphertxt);
+  ptxt.toPolyCoeffs(coeffs, idx);
+
+  ZZ P, qModP;
+  P = ciphertxt.ptxtSpace;
+  qModP = 1;
+  if (P>2) { // if p>2, multiply by Q^{-1} mod p
+    rem(qModP, context.productOfPrimes(ciphertxt.getPrimeSet()), P);
+    if (qModP != 1) InvMod(qModP, qModP, P);
   }
-  // Add in the multiples of the fromKey secret key
-  fromKey *= context.productOfPrimes(context.specialPrimes);
-  for (long i = 0; i < n; i++) {
-    ksMatrix.b[i] += fromKey;
-    fromKey *= context.productOfPrimes(context.digits[i]);
+  for (size_t k=0; k<coeffs.size(); k++) {
+    rem(coeffs[k], coeffs[k], P); // in [0,p-1]
+    if (qModP != 1) MulMod(coeffs[k], coeffs[k], qModP, P);
   }
+}
 
-  // Push the new matrix onto our list
-  keySwitching.push_back(ksMatrix);
+void FHESecKey::addSparseKey(const DoubleCRT& sKey)
+{
+  ZZX poly;
+  sKey.toPoly(poly);
+
+  vector<long> pos;
+  for (long j = 0; j <= deg(poly); j++) {
+    if (IsZero(poly[j])) continue;
+    if (IsOne(poly[j]))            pos.push_back(j+1);
+    else if (IsOne(-poly[j]))      pos.push_back(-(j+1));
+    else { pos.clear(); break; }   // not ternary
+    if (lsize(pos) > maxSparseWeight) { pos.clear(); break; }
+  }
+  sparseKeys.push_back(pos);
+}
+
+// The sparse product is computed modulo X^m-1 and then reduced modulo
+// Phi_m(X). It costs about hwt*phi(m) additions of small integers, versus
+// a forward and inverse FFT for each of the primes for the DoubleCRT one.
+void FHESecKey::mulByKey(ZZX& out, const ZZX& a, long keyIdx,
+                         bool allowSparse) const
+{
+  FHE_TIMER_START;
+  long m = context.zMStar.getM();
+  long phim = context.zMStar.getPhiM();
+
+  bool sparse = allowSparse && hasSparseKey(keyIdx)
+    && lsize(sparseKeys[keyIdx]) <= context.numPrimes()*NumBits(phim);
+
+  if (!sparse) {
+    DoubleCRT prod(a, context);   // wrt all the primes
+    prod *= sKeys.at(keyIdx);
+    prod.toPoly(out);
+    return;
+  }
+
+  const vector<long>& pos = sparseKeys[keyIdx];
+  ZZX acc;
+  acc.rep.SetLength(m);
+  for (long j = 0; j < m; j++) clear(acc.rep[j]);
+
+  long da = deg(a);
+  for (size_t k = 0; k < pos.size(); k++) {
+    long shift = labs(pos[k]) - 1;
+    for (long j = 0; j <= da; j++) {
+      long t = (j + shift) % m;    // X^m = 1 mod X^m-1
+      if (pos[k] > 0) add(acc.rep[t], acc.rep[t], a.rep[j]);
+      else            sub(acc.rep[t], acc.rep[t], a.rep[j]);
+    }
+  }
+  acc.normalize();
+  rem(out, acc, context.zMStar.getPhimX()); // Phi_m divides X^m-1
 }
-#endif
 
 // Decryption
 void FHESecKey::Decrypt(ZZX& plaintxt, const Ctxt &ciphertxt) const
@@ -940,41 +1145,7 @@ void FHESecKey::Decrypt(ZZX& plaintxt, const Ctxt &ciphertxt,
   IndexSet s; ciphertxt.findBaseSet(s);
 #endif
   FHE_TIMER_START;
-  assert(getContext()==ciphertxt.getContext());
-  const IndexSet& ptxtPrimes = ciphertxt.primeSet;
-  DoubleCRT ptxt(context, ptxtPrimes); // Set to zero
-
-  // for each ciphertext part, fetch the right key, multiply and add
-  for (size_t i=0; i<ciphertxt.parts.size(); i++) {
-    const CtxtPart& part = ciphertxt.parts[i];
-    //  cout << "decrypt part: "<<part.skHandle<<" "<< part.getIndexSet()<<"\n";
-    if (part.skHandle.isOne()) { // No need to multiply
-      ptxt += part;
-      continue;
-    }
-
-    long keyIdx = part.skHandle.getSecretKeyID();
-    DoubleCRT key = sKeys.at(keyIdx); // copy object, not a reference
-    const IndexSet extraPrimes = key.getIndexSet() / ptxtPrimes;
-    key.removePrimes(extraPrimes);    // drop extra primes, for efficiency
-
-    /* Perhaps a slightly more efficient way of doing the same thing is:
-       DoubleCRT key(context, ptxtPrimes); // a zero object wrt ptxtPrimes
-       key.Add(sKeys.at(keyIdx), false); // add without mathcing primesSet
-    */
-    long xPower = part.skHandle.getPowerOfX();
-    long sPower = part.skHandle.getPowerOfS();
-    if (xPower>1) { 
-      key.automorph(xPower); // s(X^t)
-    }
-    if (sPower>1) {
-      key.Exp(sPower);       // s^r(X^t)
-    }
-    key *= part;
-    ptxt += key;
-  }
-  // convert to coefficient representation & reduce modulo the plaintext space
-  ptxt.toPoly(plaintxt);
+  decryptPoly(plaintxt, ciphertxt);
   f = plaintxt;
 
   if (ciphertxt.ptxtSpace>2) { // if p>2, multiply by Q^{-1} mod p
@@ -990,7 +1161,51 @@ void FHESecKey::Decrypt(ZZX& plaintxt, const Ctxt &ciphertxt,
   PolyRed(plaintxt, ciphertxt.ptxtSpace, true/*reduce to [0,p-1]*/);
 }
 
-// Decryption
+// Same as Decrypt, the parts are read in place
+void FHESecKey::Decrypt(ZZX& plaintxt, const CtxtView &ciphertxt) const
+{
+  FHE_TIMER_START;
+  DoubleCRT ptxt(context, ciphertxt.getPrimeSet());
+  decryptDCRT(ptxt, ciphertxt);
+  ptxt.toPoly(plaintxt);
+
+  ZZ P, qModP;
+  P = ciphertxt.getPtxtSpace();
+  if (P>2) { // if p>2, multiply by Q^{-1} mod p
+    rem(qModP, context.productOfPrimes(ciphertxt.getPrimeSet()), P);
+    if (qModP != 1) {
+      InvMod(qModP, qModP, P);
+      MulMod(plaintxt, plaintxt, qModP, P);
+    }
+  }
+  PolyRed(plaintxt, P, true/*reduce to [0,p-1]*/);
+}
+
+// The parts are in coefficient form modulo Q', so <c,s> is computed
+// exactly over the integers and then reduced mod Q'
+void FHESecKey::Decrypt(ZZX& plaintxt, const PackedCtxt &ciphertxt) const
+{
+  FHE_TIMER_START;
+  assert (&ciphertxt.pubKey->getContext() == &context);
+  ZZX c0, c1;
+  ciphertxt.unpack(c0, c1);
+  mulByKey(plaintxt, c1, ciphertxt.keyID);
+  plaintxt += c0;
+  PolyRed(plaintxt, ciphertxt.modulus); // symmetric, in (-Q'/2,Q'/2]
+
+  ZZ P, qModP;
+  P = ciphertxt.ptxtSpace;
+  if (P>2) { // if p>2, multiply by Q'^{-1} mod p
+    rem(qModP, ciphertxt.modulus, P);
+    if (qModP != 1) {
+      InvMod(qModP, qModP, P);
+      MulMod(plaintxt, plaintxt, qModP, P);
+    }
+  }
+  PolyRed(plaintxt, P, true/*reduce to [0,p-1]*/);
+}
+
+// Noise: the size of <c,s> - plaintxt, before the reduction mod ptxtSpace
 long FHESecKey::Noise(ZZX& plaintxt, const Ctxt &ciphertxt) const
 {
   ZZX f;
@@ -999,59 +1214,11 @@ long FHESecKey::Noise(ZZX& plaintxt, const Ctxt &ciphertxt) const
 long FHESecKey::Noise(ZZX& plaintxt, const Ctxt &ciphertxt,
 			ZZX& f) const // plaintext before modular reduction
 {
-	ZZX ns;
-#ifdef DEBUG_PRINTOUT
-  // The call to findBaseSet is only for the purpose of printing a
-  // warning if the noise is large enough so as to risk decryption error
-  IndexSet s; ciphertxt.findBaseSet(s);
-#endif
   FHE_TIMER_START;
-  assert(getContext()==ciphertxt.getContext());
-  const IndexSet& ptxtPrimes = ciphertxt.primeSet;
-  DoubleCRT ptxt(context, ptxtPrimes); // Set to zero
-
-  // for each ciphertext part, fetch the right key, multiply and add
-  for (size_t i=0; i<ciphertxt.parts.size(); i++) {
-    const CtxtPart& part = ciphertxt.parts[i];
-    //  cout << "decrypt part: "<<part.skHandle<<" "<< part.getIndexSet()<<"\n";
-    if (part.skHandle.isOne()) { // No need to multiply
-      ptxt += part;
-      continue;
-    }
-
-    long keyIdx = part.skHandle.getSecretKeyID();
-    DoubleCRT key = sKeys.at(keyIdx); // copy object, not a reference
-    const IndexSet extraPrimes = key.getIndexSet() / ptxtPrimes;
-    key.removePrimes(extraPrimes);    // drop extra primes, for efficiency
-
-    /* Perhaps a slightly more efficient way of doing the same thing is:
-       DoubleCRT key(context, ptxtPrimes); // a zero object wrt ptxtPrimes
-       key.Add(sKeys.at(keyIdx), false); // add without mathcing primesSet
-    */
-    long xPower = part.skHandle.getPowerOfX();
-    long sPower = part.skHandle.getPowerOfS();
-    if (xPower>1) {
-      key.automorph(xPower); // s(X^t)
-    }
-    if (sPower>1) {
-      key.Exp(sPower);       // s^r(X^t)
-    }
-    key *= part;
-    ptxt += key;
-  }
-  // convert to coefficient representation & reduce modulo the plaintext space
-  ptxt.toPoly(ns);
+  ZZX ns;
+  decryptPoly(ns, ciphertxt);
   f = ns;
 
-//  if (ciphertxt.ptxtSpace>2) { // if p>2, multiply by Q^{-1} mod p
-//    ZZ qModP;
-//    rem(qModP, context.productOfPrimes(ciphertxt.getPrimeSet()),
-//		     ciphertxt.ptxtSpace);
-//    if (qModP != 1) {
-//      InvMod(qModP, qModP, ciphertxt.ptxtSpace);
-//      MulMod(ns, ns, qModP, ciphertxt.ptxtSpace);
-//    }
-//  }
   ns -= plaintxt;
   return MaxBits(ns);
 }
@@ -1060,7 +1227,7 @@ long FHESecKey::Noise(ZZX& plaintxt, const Ctxt &ciphertxt,
 // Encryption using the secret key, this is useful, e.g., to put an
 // encryption of the secret key into the public key.
 long FHESecKey::Encrypt(Ctxt &ctxt, const ZZX& ptxt,
-			long ptxtSpace, long skIdx) const
+			long ptxtSpace, long skIdx, const ZZ* c1Seed) const
 {
   FHE_TIMER_START;
   assert(((FHEPubKey*)this) == &ctxt.pubKey);
@@ -1083,7 +1250,13 @@ long FHESecKey::Encrypt(Ctxt &ctxt, const ZZX& ptxt,
   ctxt.parts[1].skHandle.setBase(skIdx);
 
   const DoubleCRT& sKey = sKeys.at(skIdx);   // get key
-  RLWE(ctxt.parts[0], ctxt.parts[1], sKey, ptxtSpace); // a new RLWE instance
+  if (c1Seed != NULL) { // c1 from its own PRG stream, the error from NTL's
+    { RandomState state;
+      ctxt.parts[1].randomize(c1Seed); }
+    RLWE1(ctxt.parts[0], ctxt.parts[1], sKey, ptxtSpace);
+  }
+  else
+    RLWE(ctxt.parts[0], ctxt.parts[1], sKey, ptxtSpace); // a new RLWE instance
 
   // add in the plaintext
   ctxt.addConstant(ptxt);
@@ -1093,7 +1266,7 @@ long FHESecKey::Encrypt(Ctxt &ctxt, const ZZX& ptxt,
 // Encryption using the secret key, this is useful, e.g., to put an
 // encryption of the secret key into the public key.
 ZZ FHESecKey::Encrypt(Ctxt &ctxt, const ZZX& ptxt,
-			ZZ ptxtSpace, long skIdx) const
+			ZZ ptxtSpace, long skIdx, const ZZ* c1Seed) const
 {
 #ifdef VERBOSE
 	std::cout << "FHESecKey::Encrypt" << std::endl;
@@ -1126,7 +1299,13 @@ std::cout << "\tctxt.noiseVar = context.stdev*context.stdev * phim * to_xdouble(
   ctxt.parts[1].skHandle.setBase(skIdx);
 
   const DoubleCRT& sKey = sKeys.at(skIdx);   // get key
-  RLWE(ctxt.parts[0], ctxt.parts[1], sKey, ptxtSpace); // a new RLWE instance
+  if (c1Seed != NULL) { // c1 from its own PRG stream, the error from NTL's
+    { RandomState state;
+      ctxt.parts[1].randomize(c1Seed); }
+    RLWE1(ctxt.parts[0], ctxt.parts[1], sKey, ptxtSpace);
+  }
+  else
+    RLWE(ctxt.parts[0], ctxt.parts[1], sKey, ptxtSpace); // a new RLWE instance
 #ifdef VERBOSE
   ZZX p2(0);
   std::cout << " \033[31m/!\\ Noise before addConstant: " << this->Noise(p2, ctxt) << "\033[0m" << std::endl;
@@ -1144,6 +1323,28 @@ std::cout << "\tctxt.noiseVar = context.stdev*context.stdev * phim * to_xdouble(
 }
 #endif
 
+// Encrypt as usual with a fresh seed for c1, then keep only the seed and c0
+#ifndef BIG_P
+long FHESecKey::Encrypt(SeededCtxt &ctxt, const ZZX& ptxt,
+			long ptxtSpace, long skIdx) const
+#else
+ZZ FHESecKey::Encrypt(SeededCtxt &ctxt, const ZZX& ptxt,
+			ZZ ptxtSpace, long skIdx) const
+#endif
+{
+  assert(((FHEPubKey*)this) == ctxt.pubKey);
+
+  Ctxt full(*this);
+  RandomBits(ctxt.seed, SeededCtxt::seedBits);
+  ptxtSpace = Encrypt(full, ptxt, ptxtSpace, skIdx, &ctxt.seed);
+
+  ctxt.c0 = full.parts[0];
+  ctxt.ptxtSpace = full.ptxtSpace;
+  ctxt.noiseVar = full.noiseVar;
+  ctxt.keyID = skIdx;
+  return ptxtSpace;
+}
+
 #ifndef BIG_P
 // Generate bootstrapping data if needed, returns index of key
 long FHESecKey::genRecryptData()
@@ -1193,7 +1394,10 @@ istream& operator>>(istream& str, FHESecKey& sk)
   long nKeys;
   str >> nKeys;
   sk.sKeys.resize(nKeys, DoubleCRT(sk.getContext(),IndexSet::emptySet()));
-  for (long i=0; i<nKeys; i++) str >> sk.sKeys[i];
+  for (long i=0; i<nKeys; i++) {
+    str >> sk.sKeys[i];
+    sk.addSparseKey(sk.sKeys[i]);
+  }
   seekPastChar(str, ']');
   //  cerr << "]\n";
   return str;
@@ -21,9 +21,14 @@
    @brief Public/secret keys for the BGV cryptosystem
 */
 
+#include <list>
+#include <map>
+#include <memory>
 #include "DoubleCRT.h"
 #include "FHEContext.h"
 #include "Ctxt.h"
+#include "multicore.h"
+#include "binio.h"
 
 /**
  * @class KeySwitch
@@ -247,6 +252,10 @@ public:
 	       bool highNoise=false) const;
 
   void NFLlib2HElib(Ctxt &ciphertxt, const char* file_c0, const char* file_c1, ZZ ptxtSpace = to_ZZ(0)) const;
+
+  //! @brief Same as above with c0,c1 already converted, e.g. by an
+  //! NFLlibReader. The primes of the ciphertext are those of c0,c1.
+  void NFLlib2HElib(Ctxt &ciphertxt, const DoubleCRT& c0, const DoubleCRT& c1, ZZ ptxtSpace = to_ZZ(0)) const;
 #endif
 
   bool isBootstrappable() const { return (recryptKeyID>=0); }
@@ -255,11 +264,58 @@ public:
   friend class FHESecKey;
   friend ostream& operator << (ostream& str, const FHEPubKey& pk);
   friend istream& operator >> (istream& str, FHEPubKey& pk);
+  friend void writeBinary(ostream& str, const FHEPubKey& pk);
+  friend void readBinary(BinaryInput& in, FHEPubKey& pk);
 
   // defines plaintext space for the bootstrapping encrypted secret key
   static long ePlusR(long p);
 };
 
+/**
+ * @class SecKeyPowerCache
+ * @brief Secret-key elements s_i^r(X^t), restricted to a set of primes
+ *
+ * Entries are computed on demand by FHESecKey (see keyPower) and shared, so
+ * an entry remains valid for its users even if the cache is cleared in the
+ * meantime. The cache is bounded by the size of its entries in bytes; when
+ * full, the least recently used entries are evicted, so the hot ones (such
+ * as s and s^2 over the current primes) stay. Copying a cache gives an
+ * empty one.
+ **/
+class SecKeyPowerCache {
+  typedef list< vector<long> > LRUList; // most recently used first
+  struct Entry {
+    shared_ptr<const DoubleCRT> key;
+    long bytes;
+    LRUList::iterator pos;
+  };
+
+  mutable FHE_MUTEX_TYPE mx;
+  map< vector<long>, Entry > entries;
+  mutable LRUList lru;
+  long totalBytes, maxBytes;
+
+  void evict(long limit);
+
+public:
+  static const long defaultMaxBytes = 64L << 20; // 64MB
+
+  SecKeyPowerCache(): totalBytes(0), maxBytes(defaultMaxBytes) {}
+  SecKeyPowerCache(const SecKeyPowerCache& other)
+    : totalBytes(0), maxBytes(other.maxBytes) {}
+  SecKeyPowerCache& operator=(const SecKeyPowerCache&)
+  { clear(); return *this; }
+
+  shared_ptr<const DoubleCRT> find(const vector<long>& id) const;
+  void insert(const vector<long>& id, shared_ptr<const DoubleCRT> key);
+  void clear();
+  long size() const;
+  long bytes() const;
+
+  //! @brief Bound the size of the cache, evicting entries if needed
+  void setMaxBytes(long n);
+};
+
 /**
  * @class FHESecKey
  * @brief The secret key
@@ -269,6 +325,29 @@ class FHESecKey: public FHEPubKey { // The secret key
 public:
   vector<DoubleCRT> sKeys; // The secret key(s) themselves
 
+private:
+  mutable SecKeyPowerCache keyCache; // for decryption
+
+  // Sparse representation of the keys in coefficient form: the coefficient
+  // of X^j is +1 (resp. -1) if j+1 (resp. -(j+1)) is in sparseKeys[i].
+  // Empty if the key is not ternary or is too dense.
+  vector< vector<long> > sparseKeys;
+  void addSparseKey(const DoubleCRT& sKey);
+
+  // Adds <c,s> in double-CRT form to ptxt, which is initially zero and
+  // defined wrt the primes of ciphertxt
+  void decryptDCRT(DoubleCRT& ptxt, const Ctxt &ciphertxt) const;
+  void decryptDCRT(DoubleCRT& ptxt, const CtxtView &ciphertxt) const;
+
+  // <c,s> in coefficient representation, before the reduction mod ptxtSpace
+  void decryptPoly(ZZX& f, const Ctxt &ciphertxt) const;
+
+  // Builds and stores the matrices for GenKeySWmatrices, once the plaintext
+  // space p is known
+  template<class PT>
+  void buildKeySWmatrices(const vector< pair<long,long> >& powers,
+                          long fromIdx, long toIdx, PT p, long nthreads);
+
 public:
 
   // Constructors just call the ones for the base class
@@ -279,7 +358,31 @@ public:
   bool operator!=(const FHESecKey& other) const {return !(*this==other);}
 
   void clear() // clear all secret-key data
-  { FHEPubKey::clear(); sKeys.clear(); }
+  { FHEPubKey::clear(); sKeys.clear(); keyCache.clear(); sparseKeys.clear(); }
+
+  //! Keys of weight up to maxSparseWeight are also kept in sparse form
+  static const long maxSparseWeight = 1024;
+  bool hasSparseKey(long keyIdx=0) const
+  { return keyIdx < lsize(sparseKeys) && !sparseKeys[keyIdx].empty(); }
+
+  //! @brief out = a*s_i in Z[X]/Phi_m(X), computed exactly. With a sparse
+  //! key, and if it is estimated to be cheaper than the DoubleCRT product
+  //! (and allowSparse is set), this takes hwt shifted additions in
+  //! coefficient form instead of FFTs over all the primes.
+  void mulByKey(ZZX& out, const ZZX& a, long keyIdx=0,
+                bool allowSparse=true) const;
+
+  //! @brief The secret-key element s_i^r(X^t) that matches the handle,
+  //! restricted to the primes in s. Cached, so the powers and automorphisms
+  //! are computed once for each prime set.
+  shared_ptr<const DoubleCRT> keyPower(const SKHandle& handle,
+                                       const IndexSet& s) const;
+
+  //! @brief Must be called if the sKeys are modified directly
+  void invalidateKeyCache() const { keyCache.clear(); }
+
+  //! @brief Bound the memory used by the cache of keyPower (in bytes)
+  void setKeyCacheBytes(long n) const { keyCache.setMaxBytes(n); }
 
 
   //! We allow the calling application to choose a secret-key polynomial by
@@ -339,6 +442,20 @@ public:
 		      long toKeyIdx=0, ZZ ptxtSpace = to_ZZ(0));
 #endif
 
+  //! @brief Generate the matrices for all the pairs (fromSPower,fromXPower)
+  //! in powers at once, as with GenKeySWmatrix. The matrices and their
+  //! columns are built concurrently when compiled with -DFHE_CTXT_THREADS
+  //! (see parallelBatch), and the result does not depend on nthreads.
+#ifndef BIG_P
+  void GenKeySWmatrices(const vector< pair<long,long> >& powers,
+                        long fromKeyIdx=0, long toKeyIdx=0,
+                        long ptxtSpace=0, long nthreads=0);
+#else
+  void GenKeySWmatrices(const vector< pair<long,long> >& powers,
+                        long fromKeyIdx=0, long toKeyIdx=0,
+                        ZZ ptxtSpace=to_ZZ(0), long nthreads=0);
+#endif
+
   // Decryption
   void Decrypt(ZZX& plaintxt, const Ctxt &ciphertxt) const;
   long Noise(ZZX& plaintxt, const Ctxt &ciphertxt) const;
@@ -348,13 +465,41 @@ public:
   void Decrypt(ZZX& plaintxt, const Ctxt &ciphertxt, ZZX& f) const;
   long Noise(ZZX& plaintxt, const Ctxt &ciphertxt, ZZX& f) const;
 
+  //! @brief Decrypt only the coefficients of the plaintext with the given
+  //! indexes, e.g. the constant term of a scalar plaintext. The results
+  //! are reduced to [0,ptxtSpace-1] as with Decrypt.
+  void DecryptCoeffs(vector<ZZ>& coeffs, const Ctxt &ciphertxt,
+                     const vector<long>& idx) const;
+  void DecryptCoeffs(ZZ& coeff, const Ctxt &ciphertxt, long idx=0) const
+  { vector<ZZ> v; DecryptCoeffs(v, ciphertxt, vector<long>(1, idx));
+    coeff = v[0]; }
+
+  //! @brief Decrypt a ciphertext held in an external buffer, see CtxtView
+  void Decrypt(ZZX& plaintxt, const CtxtView &ciphertxt) const;
+
+  //! @brief Decrypt a ciphertext squashed for transport, see PackedCtxt.
+  //! With a sparse key this takes no FFT at all.
+  void Decrypt(ZZX& plaintxt, const PackedCtxt &ciphertxt) const;
+
 #ifndef BIG_P
-  //! @brief Symmetric encryption using the secret key.
+  //! @brief Symmetric encryption using the secret key. If c1Seed!=NULL,
+  //! the part wrt s is generated from it (see SeededCtxt), without
+  //! affecting the state of NTL's PRG.
   long Encrypt(Ctxt &ctxt, const ZZX& ptxt,
+	       long ptxtSpace=0, long skIdx=0, const ZZ* c1Seed=NULL) const;
+
+  //! @brief Symmetric encryption in compressed form, see SeededCtxt
+  long Encrypt(SeededCtxt &ctxt, const ZZX& ptxt,
 	       long ptxtSpace=0, long skIdx=0) const;
 #else
-  //! @brief Symmetric encryption using the secret key.
+  //! @brief Symmetric encryption using the secret key. If c1Seed!=NULL,
+  //! the part wrt s is generated from it (see SeededCtxt), without
+  //! affecting the state of NTL's PRG.
   ZZ Encrypt(Ctxt &ctxt, const ZZX& ptxt,
+	       ZZ ptxtSpace, long skIdx=0, const ZZ* c1Seed=NULL) const;
+
+  //! @brief Symmetric encryption in compressed form, see SeededCtxt
+  ZZ Encrypt(SeededCtxt &ctxt, const ZZX& ptxt,
 	       ZZ ptxtSpace, long skIdx=0) const;
 #endif
 
@@ -363,6 +508,8 @@ public:
 
   friend ostream& operator << (ostream& str, const FHESecKey& sk);
   friend istream& operator >> (istream& str, FHESecKey& sk);
+  friend void writeBinary(ostream& str, const FHESecKey& sk);
+  friend void readBinary(BinaryInput& in, FHESecKey& sk);
 };
 
 //! @name Strategies for generating key-switching matrices
@@ -146,6 +146,44 @@ long FindM(long k, long L, long c, long p, long d, long s, long chosen_m, bool v
   return m;
 }
 
+#ifdef BIG_P
+long FindM(long k, long L, long c, const ZZ& p, long nPrimesByLvl,
+           long chosen_m, bool verbose)
+{
+  // The chain has (L+1)*nPrimesByLvl half-size primes (counted in units of
+  // FHE_DEFAULT_p2Size/2 bits), and the special primes add about 1/c of
+  // that. The bound on N=phi(m) is then the same as in FindM above.
+  double logQ = (L+1)*nPrimesByLvl*(FHE_DEFAULT_p2Size/2.0);
+  double cc = 1.0+(1.0/(double)c);
+  double dN = (k>0)? ceil(logQ*cc*(k+110)/7.2) : 0.0;
+  if (dN > (1L<<20)) {
+    cerr << "Cannot support a bound of " << dN;
+    Error(", aborting.\n");
+  }
+  long N = dN;
+
+  long m = 0;
+  if (chosen_m) {
+    if (phi_N(chosen_m) >= N && divide(p, chosen_m) == 0)
+      m = chosen_m;
+  }
+  else { // the smallest prime m with phi(m)=m-1 >= N
+    for (long candidate=max(N+1,3L)|1; candidate<=(1L<<20); candidate+=2)
+      if (ProbPrime(candidate) && divide(p, candidate) == 0) {
+        m = candidate;
+        break;
+      }
+  }
+
+  if (verbose) {
+    cerr << "*** Bound N="<<N<<", choosing m="<<m <<", phi(m)="<< phi_N(m)
+         << endl;
+  }
+
+  return m;
+}
+#endif
+
 // A global variable, pointing to the "current" context
 FHEcontext* activeContext = NULL;
 
@@ -229,16 +267,18 @@ double AddManyPrimes(FHEcontext& context, double totalSize,
     long sizeBits = 2*context.bitsPerLevel;
 #endif
     if (special) {
-      long numPrimes = ceil(totalSize/NTL_SP_NBITS);// how many special primes
+      long numPrimes = ceil(totalSize/FHE_maxPrimeBits);// how many special primes
       sizeBits = ceil(totalSize/numPrimes);         // what's the size of each
     }
     long twoM = 2 * context.zMStar.getM();
 
-    if (sizeBits>NTL_SP_NBITS) sizeBits = NTL_SP_NBITS;
+    if (sizeBits>FHE_maxPrimeBits) sizeBits = FHE_maxPrimeBits;
     long sizeBound = 1L << sizeBits;
     if (sizeBound < twoM*log2(twoM)*8) {
       sizeBits = ceil(log2(twoM*log2(twoM)))+3;
       sizeBound = 1L << sizeBits;
+      if (sizeBits > FHE_maxPrimeBits) // e.g. with FHE_SMALL_PRIMES
+        Error("AddManyPrimes: m is too large for the maximum prime size");
     }
 
     // make p-1 divisible by m*2^k for as large k as possible
@@ -348,12 +388,11 @@ void buildModChain(FHEcontext &context, long nLevels, long nDgts)
   AddPrimesBySize(context, sizeOfSpecialPrimes, true);
 }
 #else
-void buildModChain(FHEcontext &context, long nLevels, long nDgts, long nPrimesByLvl)
+// Build a chain with nPrimes ciphertext primes (including the half-size
+// one), then split them into digits and add the special primes
+static void buildModChainByNumber(FHEcontext &context, long nPrimes, long nDgts)
 {
-#ifdef NO_HALF_SIZE_PRIME
-  long nPrimes = (nLevels+1)*nPrimesByLvl;
-#else
-long nPrimes = (nLevels+1)*nPrimesByLvl/2;//((nLevels+1)*28)/2;//((nLevels+1)*179)/2;
+#ifndef NO_HALF_SIZE_PRIME
   // The first prime should be of half the size. The code below tries to find
   // a prime q0 of this size where q0-1 is divisible by 2^k * m for some k>1.
   // Then if the plaintext space is a power of two it tries to choose the
@@ -422,7 +461,11 @@ long nPrimes = (nLevels+1)*nPrimesByLvl/2;//((nLevels+1)*28)/2;//((nLevels+1)*17
     context.digits[0] = context.ctxtPrimes;
   }
 
-  // Add primes to the chain for the P factor of key-switching
+  // Add primes to the chain for the P factor of key-switching. P only needs
+  // to cover the largest digit, which shrinks together with a shorter
+  // (e.g. calibrated) chain, so it is not over-provisioned by the digits
+  // that were removed. The key-switching noise measured by calibrateModChain
+  // already includes this choice of P.
   double lp2r = log(context.ModulusP());
 #ifdef VERBOSE
   std::cout << "maxDigitSize: " << maxDigitSize << std::endl;
@@ -434,6 +477,41 @@ long nPrimes = (nLevels+1)*nPrimesByLvl/2;//((nLevels+1)*28)/2;//((nLevels+1)*17
 #endif
   AddPrimesBySize(context, sizeOfSpecialPrimes, true);
 }
+
+void buildModChain(FHEcontext &context, long nLevels, long nDgts, long nPrimesByLvl)
+{
+#if (defined(FHE_LARGE_PRIMES) || defined(FHE_SMALL_PRIMES))
+  // nPrimesByLvl is given in units of the default-size primes, so scale it
+  // to get the same modulus size when the chain uses larger/smaller primes.
+  // Default builds keep their chains, even where NTL_SP_NBITS is smaller.
+  if (context.bitsPerLevel != FHE_DEFAULT_p2Size/2)
+    nPrimesByLvl = ceil(nPrimesByLvl * (FHE_DEFAULT_p2Size/2.0)
+                        / context.bitsPerLevel);
+#endif
+
+#ifdef NO_HALF_SIZE_PRIME
+  long nPrimes = (nLevels+1)*nPrimesByLvl;
+#else
+  long nPrimes = (nLevels+1)*nPrimesByLvl/2;
+#endif
+  buildModChainByNumber(context, nPrimes, nDgts);
+}
+
+void buildModChainByTotal(FHEcontext &context, long nHalfPrimes, long nDgts)
+{
+  // Same units as nPrimesByLvl above, rescaled to the size of our primes
+  double scaled = nHalfPrimes;
+#if (defined(FHE_LARGE_PRIMES) || defined(FHE_SMALL_PRIMES))
+  scaled *= (FHE_DEFAULT_p2Size/2.0) / context.bitsPerLevel;
+#endif
+
+#ifdef NO_HALF_SIZE_PRIME
+  long nPrimes = ceil(scaled);
+#else
+  long nPrimes = ceil(scaled/2);
+#endif
+  buildModChainByNumber(context, nPrimes, nDgts);
+}
 #endif
 bool FHEcontext::operator==(const FHEcontext& other) const
 {
@@ -40,6 +40,22 @@
  **/
 long FindM(long k, long L, long c, long p, long d, long s, long chosen_m, bool verbose=false);
 
+#ifdef BIG_P
+/**
+ * @brief Returns smallest prime m satisfying the security constraint for a
+ * chain built by buildModChain(context, L, c, nPrimesByLvl):
+ * @param k security parameter (k<=0 => no constraint)
+ * @param L number of levels
+ * @param c number of columns in key switching matrices
+ * @param p plaintext modulus
+ * @param nPrimesByLvl number of half-size primes per level
+ * @param chosen_m preselected value of m (0 => not preselected)
+ * Fails with an error message if no suitable m is found
+ **/
+long FindM(long k, long L, long c, const ZZ& p, long nPrimesByLvl,
+           long chosen_m, bool verbose=false);
+#endif
+
 #ifdef USE_ALT_CRT
 #define ALT_CRT (1)
 #else
@@ -47,15 +63,29 @@ long FindM(long k, long L, long c, long p, long d, long s, long chosen_m, bool v
 #endif
 
 // FIXME: The size of primes in the chain should be computed at run-time
-#if (NTL_SP_NBITS<44)  //#if (ALT_CRT || NTL_SP_NBITS<44)
+#define FHE_DEFAULT_p2Size 44
+
+// With FHE_LARGE_PRIMES we use primes as large as NTL's single-precision
+// arithmetic allows (typically 60 bits on 64-bit platforms), so fewer rows
+// are needed in every DoubleCRT object for the same modulus size.
+// With FHE_SMALL_PRIMES all the primes (including the special ones) have
+// at most 31 bits, so residues can be kept in 32-bit words, see the class
+// CompactDoubleCRT in DoubleCRT.h.
+#if (defined(FHE_SMALL_PRIMES))
+#define FHE_p2Size 30
+#define FHE_maxPrimeBits 31
+#elif (NTL_SP_NBITS<FHE_DEFAULT_p2Size || defined(FHE_LARGE_PRIMES))
 #define FHE_p2Size NTL_SP_NBITS
+#define FHE_maxPrimeBits NTL_SP_NBITS
 #else
-#define FHE_p2Size 44
+#define FHE_p2Size FHE_DEFAULT_p2Size
+#define FHE_maxPrimeBits NTL_SP_NBITS
 #endif
 #define FHE_p2Bound (1L<<FHE_p2Size)
 #define FHE_pSize (FHE_p2Size/2) /* The size of levels in the chain */
 
 class EncryptedArray;
+class BinaryInput; // see binio.h
 /**
  * @class FHEcontext
  * @brief Maintaining the parameters
@@ -293,6 +323,9 @@ public:
 
   //! @brief read all other data associated with context
   friend istream& operator>> (istream &str, FHEcontext& context);
+
+  //! @brief binary counterpart of operator>>, see binio.h
+  friend void readContextBinary(BinaryInput& in, FHEcontext& context);
   ///@}
 };
 
@@ -335,7 +368,18 @@ inline double AddPrimesByNumber(FHEcontext& context, long nPrimes,
 void buildModChain(FHEcontext &context, long nLevels, long c=3);
 #else
 //! @brief Build modulus chain with nLevels levels, using c digits in key-switching
+//! nPrimesByLvl is the number of half-size primes per level, counted in units
+//! of FHE_DEFAULT_p2Size/2 bits when compiling with FHE_LARGE_PRIMES or
+//! FHE_SMALL_PRIMES (it is then rescaled to the size of the primes), and of
+//! the primes of the platform otherwise
 void buildModChain(FHEcontext &context, long nLevels, long c=3, long nPrimesByLvl=50);
+
+//! @brief Build a modulus chain with a total of nHalfPrimes half-size primes
+//! (same units as nPrimesByLvl above). Levels are not tied to fixed prime
+//! boundaries, mod-switching drops primes as the noise estimate requires,
+//! so only the total size of the chain matters.
+//! See calibrateModChain in paramTuning.h for a way to compute nHalfPrimes.
+void buildModChainByTotal(FHEcontext &context, long nHalfPrimes, long c=3);
 #endif
 
 ///@}
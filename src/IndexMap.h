@@ -30,6 +30,9 @@ public:
   //! @brief Initialization function, override with initialization code
   virtual void init(T&) = 0;
 
+  //! @brief Called before an element is destroyed, override to recycle it
+  virtual void release(T&) {}
+
   //! @brief Cloning a pointer, override with code to create a fresh copy
   virtual IndexMapInit<T> * clone() const = 0; 
   virtual ~IndexMapInit() {} // ensure that derived destructor is called
@@ -104,18 +107,30 @@ public:
   }
 
   //! @brief Delete indexes from IndexSet, may cause objects to be destroyed.
-  void remove(long j) { indexSet.remove(j); map.erase(j); }
+  //! Destroyed objects are first passed to the release method of the
+  //! IndexMapInit<T> object, if any.
+  void remove(long j) {
+    if (!init.null() && indexSet.contains(j)) init->release(map[j]);
+    indexSet.remove(j); map.erase(j);
+  }
   void remove(const IndexSet& s) { 
-    for (long i = s.first(); i <= s.last(); i = s.next(i))
+    for (long i = s.first(); i <= s.last(); i = s.next(i)) {
+      if (!init.null() && indexSet.contains(i)) init->release(map[i]);
       map.erase(i);
+    }
     indexSet.remove(s);
   }
 
   void clear() { 
+    if (!init.null())
+      for (long i = indexSet.first(); i <= indexSet.last(); i = indexSet.next(i))
+        init->release(map[i]);
     map.clear();
     indexSet.clear();
   }  
 
+  ~IndexMap() { clear(); }
+
 
 };
 
@@ -29,10 +29,12 @@ void addAllMatrices(FHESecKey& sKey, long keyID)
   long m = context.zMStar.getM();
 
   // key-switching matrices for the automorphisms
+  vector< pair<long,long> > powers;
   for (long i = 0; i < m; i++) {
     if (!context.zMStar.inZmStar(i)) continue;
-    sKey.GenKeySWmatrix(1, i, keyID, keyID);
+    powers.push_back(make_pair(1L, i));
   }
+  sKey.GenKeySWmatrices(powers, keyID, keyID);
   sKey.setKeySwitchMap(); // re-compute the key-switching map
 }
 
@@ -52,16 +54,18 @@ void add1DMatrices(FHESecKey& sKey, long keyID)
   long m = context.zMStar.getM();
 
   // key-switching matrices for the automorphisms
+  vector< pair<long,long> > powers;
   for (long i = 0; i < (long)context.zMStar.numOfGens(); i++) {
     for (long j = 1; j < (long)context.zMStar.OrderOf(i); j++) {
       long val = PowerMod(context.zMStar.ZmStarGen(i), j, m); // val = g^j
       // From s(X^val) to s(X)
-      sKey.GenKeySWmatrix(1, val, keyID, keyID);
+      powers.push_back(make_pair(1L, val));
       if (!context.zMStar.SameOrd(i))
 	// also from s(X^{1/val}) to s(X)
-	sKey.GenKeySWmatrix(1, InvMod(val,m), keyID, keyID);
+	powers.push_back(make_pair(1L, InvMod(val,m)));
     }
   }
+  sKey.GenKeySWmatrices(powers, keyID, keyID);
   sKey.setKeySwitchMap(); // re-compute the key-switching map
 }
 #endif
@@ -75,16 +79,17 @@ void addSome1DMatrices(FHESecKey& sKey, long bound, long keyID)
   long m = context.zMStar.getM();
 
   // key-switching matrices for the automorphisms
+  vector< pair<long,long> > powers;
   for (long i = 0; i < (long)context.zMStar.numOfGens(); i++) {
     // For generators of small order, add all the powers
     if (bound >= (long)context.zMStar.OrderOf(i))
       for (long j = 1; j < (long)context.zMStar.OrderOf(i); j++) {
 	long val = PowerMod(context.zMStar.ZmStarGen(i), j, m); // val = g^j
 	// From s(X^val) to s(X)
-	sKey.GenKeySWmatrix(1, val, keyID, keyID);
+	powers.push_back(make_pair(1L, val));
 	if (!context.zMStar.SameOrd(i))
 	  // also from s(X^{1/val}) to s(X)
-	  sKey.GenKeySWmatrix(1, InvMod(val,m), keyID, keyID);
+	  powers.push_back(make_pair(1L, InvMod(val,m)));
       }
     else { // For generators of large order, add only some of the powers
       long num = SqrRoot(context.zMStar.OrderOf(i)); // floor(ord^{1/2})
@@ -98,12 +103,12 @@ void addSome1DMatrices(FHESecKey& sKey, long bound, long keyID)
 	long val1 = PowerMod(context.zMStar.ZmStarGen(i), j, m);  // g^j
 	long val2 = PowerMod(context.zMStar.ZmStarGen(i),num*j,m);// g^{j*num}
 	if (j < num) {
-	  sKey.GenKeySWmatrix(1, val1, keyID, keyID);
-	  sKey.GenKeySWmatrix(1, val2, keyID, keyID);
+	  powers.push_back(make_pair(1L, val1));
+	  powers.push_back(make_pair(1L, val2));
 	}
 	if (!context.zMStar.SameOrd(i)) {
 	  //	  sKey.GenKeySWmatrix(1, InvMod(val1,m), keyID, keyID);
-	  sKey.GenKeySWmatrix(1, InvMod(val2,m), keyID, keyID);
+	  powers.push_back(make_pair(1L, InvMod(val2,m)));
 	}
       }
 
@@ -117,11 +122,12 @@ void addSome1DMatrices(FHESecKey& sKey, long bound, long keyID)
         for (long k = 1; k <= num; k = 2*k) {
           long j = context.zMStar.OrderOf(i) - k;
           long val = PowerMod(context.zMStar.ZmStarGen(i), j, m); // val = g^j
-          sKey.GenKeySWmatrix(1, val, keyID, keyID);
+          powers.push_back(make_pair(1L, val));
         }
       }
     }
   }
+  sKey.GenKeySWmatrices(powers, keyID, keyID);
   sKey.setKeySwitchMap(); // re-compute the key-switching map
 }
 #else
@@ -140,10 +146,12 @@ void addFrbMatrices(FHESecKey& sKey, long keyID)
   const FHEcontext &context = sKey.getContext();
   long m = context.zMStar.getM();
 
+  vector< pair<long,long> > powers;
   for (long j = 1; j < (long)context.zMStar.getOrdP(); j++) {
     long val = PowerMod(context.zMStar.getP(), j, m); // val = p^j mod m
-    sKey.GenKeySWmatrix(1, val, keyID, keyID);
+    powers.push_back(make_pair(1L, val));
   }
+  sKey.GenKeySWmatrices(powers, keyID, keyID);
   sKey.setKeySwitchMap(); // re-compute the key-switching map
 }
 #endif
@@ -154,6 +162,7 @@ void addMatrices4Network(FHESecKey& sKey, const PermNetwork& net, long keyID)
   const FHEcontext &context = sKey.getContext();
   long m = context.zMStar.getM();
 
+  vector< pair<long,long> > powers;
   for (long i=0; i<net.depth(); i++) {
     long e = net.getLayer(i).getE();
     long gIdx = net.getLayer(i).getGenIdx();
@@ -163,9 +172,10 @@ void addMatrices4Network(FHESecKey& sKey, const PermNetwork& net, long keyID)
     for (long j=0; j<shamts.length(); j++) {
       if (shamts[j]==0) continue;
       long val = PowerMod(g2e, shamts[j], m);
-      sKey.GenKeySWmatrix(1, val, keyID, keyID);
+      powers.push_back(make_pair(1L, val));
     }
   }
+  sKey.GenKeySWmatrices(powers, keyID, keyID);
   sKey.setKeySwitchMap(); // re-compute the key-switching map
 }
 #endif
@@ -8,6 +8,7 @@
 #include <time.h>
 #include <ctime>
 #include <fstream>
+#include <sstream>
 #include "Util.h"
 #include "DoubleCRT.h"
 #include "NTL/ZZ_pX.h"
@@ -106,6 +107,88 @@ int main() {
 		 << "  Time:      " << texe/25.*((double)nb_decrypt) << " s" << endl
 	     << "  Size:      " << context.logOfProduct(c[0]->getPrimeSet())/log(2)/1000000.*context.zMStar.getPhiM()*2.*((double)nb_decrypt) << " Mb" << std::endl
 	     << "  Flow rate: " << (context.logOfProduct(c[0]->getPrimeSet())/log(2)/1000000.*context.zMStar.getPhiM())*2./(texe/25.) << " Mbps" << std::endl;
+
+
+	/*
+	 * DoubleCRT to binary residues, and back
+	 */
+	double ctxtMb = context.logOfProduct(c[0]->getPrimeSet())/log(2)/1000000.*context.zMStar.getPhiM()*2.;
+	cout << "===========================" << endl
+		 << "   " << nb_decrypt << " DoubleCRT to Binary" << endl
+		 << "---------------------------" << endl;
+	gettimeofday(&tbeg,NULL);
+	{
+		ofstream out("c_out.bin", ios::binary | ios::trunc);
+		NFLlibWriter writer(out, context, c[0]->getPrimeSet());
+		for (unsigned i = 0; i < 25; i++)
+			writer.write(*c[i]);
+	}
+	gettimeofday(&tend,NULL);
+	texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+	cout << "  Time:      " << texe/25.*((double)nb_decrypt) << " s" << endl
+	     << "  Size:      " << ctxtMb*((double)nb_decrypt) << " Mb" << std::endl
+	     << "  Flow rate: " << ctxtMb/(texe/25.) << " Mbps" << std::endl;
+
+	cout << "===========================" << endl
+		 << "   " << nb_encrypt << " Binary to DoubleCRT" << endl
+		 << "---------------------------" << endl;
+	bool match = true;
+	gettimeofday(&tbeg,NULL);
+	{
+		MappedFile file("c_out.bin");
+		MemoryInput in(file.getData(), file.size());
+		NFLlibReader reader(in, publicKey);
+		Ctxt d(publicKey);
+		unsigned n = 0;
+		for (; n < 25 && reader.read(d, plaintextModulus); n++)
+			match = match && d.parts[0] == c[n]->parts[0]
+			              && d.parts[1] == c[n]->parts[1];
+		match = match && n == 25 && !reader.read(d, plaintextModulus);
+	}
+	gettimeofday(&tend,NULL);
+	texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+	cout << "  Time:      " << texe/25.*((double)nb_encrypt) << " s" << endl
+	     << "  Size:      " << ctxtMb*((double)nb_encrypt) << " Mb" << std::endl
+	     << "  Flow rate: " << ctxtMb/(texe/25.) << " Mbps" << std::endl
+	     << "  Match:     " << (match?"true":"false") << std::endl;
+
+	/*
+	 * A producer that lists its primes in another order than the chain
+	 */
+	{
+		const IndexSet& s = c[0]->getPrimeSet();
+		long phim = context.zMStar.getPhiM(), k = card(s);
+		vector<long> primes, rows(k*phim);
+		for (long i = s.first(); i <= s.last(); i = s.next(i))
+			primes.push_back(context.ithPrime(i));
+
+		ostringstream out;
+		out.write("NFLlib\0\0", 8);
+		write_raw_long(out, phim);
+		write_raw_long(out, k);
+		for (long j = k-1; j >= 0; j--) write_raw_long(out, primes[j]);
+		write_raw_long(out, 0);
+		for (unsigned i = 0; i < 3; i++) {
+			write_raw_long(out, 1);
+			for (long part = 0; part < 2; part++) {
+				c[i]->parts[part].toResidues(&rows[0]);
+				for (long j = k-1; j >= 0; j--)
+					write_raw_row(out, &rows[j*phim], phim);
+			}
+		}
+		write_raw_long(out, 0);
+
+		string data = out.str();
+		MemoryInput in(data.data(), data.size());
+		NFLlibReader reader(in, publicKey);
+		Ctxt d(publicKey);
+		bool permuted = true;
+		for (unsigned i = 0; i < 3; i++)
+			permuted = permuted && reader.read(d, plaintextModulus)
+			                    && d.parts[0] == c[i]->parts[0]
+			                    && d.parts[1] == c[i]->parts[1];
+		cout << "  Permuted:  " << (permuted?"true":"false") << std::endl;
+	}
 	cout << "***************************" << endl;
 
 	file0 << tmp0;
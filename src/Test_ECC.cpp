@@ -118,6 +118,54 @@ int main() {
 			}
 
 
+			/*
+			 * Point Addition, with and without prepared operands
+			 */
+			ECPoint eT(publicKey);
+			cout << "===========================" << endl
+			     << "   1 Add."                   << endl
+			     << "---------------------------" << endl;
+			gettimeofday(&tbeg,NULL);
+			ec_addition(eT, *eG[0], *eG[1], precomputation_encrypted, publicKey, false);
+			gettimeofday(&tend,NULL);
+			texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+			cout << "  Plain:     " << texe << " s" << endl;
+			gettimeofday(&tbeg,NULL);
+			ec_addition(eT, *eG[0], *eG[1], precomputation_encrypted, publicKey, true);
+			gettimeofday(&tend,NULL);
+			texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+			cout << "  Prepared:  " << texe << " s" << endl;
+			{
+				ECPoint eU(publicKey), eV(publicKey);
+				ECAdditionGraph add(precomputation_encrypted, publicKey);
+				const CtxtGraph& graph = add.graph();
+				gettimeofday(&tbeg,NULL);
+				ec_addition_graph(eU, *eG[0], *eG[1], precomputation_encrypted, publicKey, &add);
+				gettimeofday(&tend,NULL);
+				texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+				long nBuffers = graph.numBuffers();
+				// The same graph, bound to other points: no new buffers
+				struct timeval treb;
+				gettimeofday(&treb,NULL);
+				add.run(eV, *eG[1], *eG[0]);
+				gettimeofday(&tend,NULL);
+				double trerun = ((double)(tend.tv_sec-treb.tv_sec)) + ((double)(tend.tv_usec-treb.tv_usec))/1000000.;
+				ZZX pT, pU;
+				bool match = true;
+				secretKey.Decrypt(pT, *eT.X); secretKey.Decrypt(pU, *eU.X); match = match && (pT == pU);
+				secretKey.Decrypt(pT, *eT.Y); secretKey.Decrypt(pU, *eU.Y); match = match && (pT == pU);
+				secretKey.Decrypt(pT, *eT.Z); secretKey.Decrypt(pU, *eU.Z); match = match && (pT == pU);
+				secretKey.Decrypt(pT, *eV.X); secretKey.Decrypt(pU, *eU.X); match = match && (pT == pU);
+				cout << "  Graph:     " << texe << " s" << endl
+				     << "  Rerun:     " << trerun << " s" << endl
+				     << "  Work:      " << graph.totalWork() << " s" << endl
+				     << "  Crit path: " << graph.criticalPath() << " s (" << graph.depth() << " ops)" << endl
+				     << "  Buffers:   " << nBuffers << " for " << graph.size() << " nodes ("
+				     << graph.numBuffers()-nBuffers << " new on rerun)" << endl
+				     << "  Match:     " << (match?"true":"false") << endl;
+			}
+
+
 			/*
 			 * Scalar Multiplication
 			 */
@@ -129,15 +177,14 @@ int main() {
 			cout << ((256/(2*wndw))>>(hght-1)) << " Add." << endl
 			     << "---------------------------" << endl;
 			gettimeofday(&tbeg,NULL);
-			long k;
-			for (k=2; k<1<<(hght+1); k<<=1) {
-				for (long i=0; i<256/wndw; i+=k) {
-					ec_addition(*eG[i], *eG[i], *eG[i+k/2], precomputation_encrypted, publicKey);
-					Debug(cout << "." << flush);
-					Debug(for(unsigned j=0; j<k-1; j++)cout << " " << flush);
-				}
-				Debug(cout << endl);
-			}
+			long k = 1<<(hght+1); // the results are in the eG[i]'s with k/2 | i
+			reductionTree(256/wndw,
+				[&](long i, long j) {
+					ec_addition(*eG[i], *eG[i], *eG[j], precomputation_encrypted, publicKey);
+					eG[j]->X->clear();
+					eG[j]->Y->clear();
+					eG[j]->Z->clear();
+				}, /*nthreads=*/0, /*maxDepth=*/hght);
 			gettimeofday(&tend,NULL);
 			texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
 			cout << "  Time:      " << texe << " s" << std::endl
@@ -27,6 +27,245 @@
 #include "timing.h"
 #include "EncryptedArray.h"
 
+#ifdef BIG_P
+/* With BIG_P, compare the binary format with the text format on the
+ * Test_SHE parameters: sizes, write and read times, and equality of the
+ * objects read back.
+ */
+#define __TEST_SHE_512__
+#include <sys/time.h>
+#include "Test_Params.hpp"
+
+static double seconds(const struct timeval& tbeg, const struct timeval& tend)
+{
+	return ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+}
+
+static double fileSize(const char* name)
+{
+	ifstream f(name, ios::binary|ios::ate);
+	return (double) f.tellg();
+}
+
+// Write obj in both formats and read it back into copy. The text format is
+// only read back if readText is set.
+template<class T>
+static void roundTrip(const char* label, const T& obj, T& copy,
+                      long type, bool readText)
+{
+	const FHEcontext& context = obj.getContext();
+	struct timeval tbeg, tend;
+	bool match = true;
+
+	cout << "===========================" << endl
+	     << "   " << label                << endl
+	     << "---------------------------" << endl;
+
+	gettimeofday(&tbeg,NULL);
+	{ ofstream out("iotest.txt");
+	  out << obj << endl; }
+	gettimeofday(&tend,NULL);
+	cout << "  Text size:   " << fileSize("iotest.txt")/1000000. << " MB" << endl
+	     << "  Text write:  " << seconds(tbeg,tend) << " s" << endl;
+	if (readText) {
+		gettimeofday(&tbeg,NULL);
+		{ ifstream in("iotest.txt");
+		  in >> copy; }
+		gettimeofday(&tend,NULL);
+		match = match && (copy == obj);
+		cout << "  Text read:   " << seconds(tbeg,tend) << " s" << endl;
+	}
+
+	gettimeofday(&tbeg,NULL);
+	{ ofstream out("iotest.bin", ios::binary);
+	  writeBinaryHeader(out, context, type);
+	  writeBinary(out, obj); }
+	gettimeofday(&tend,NULL);
+	cout << "  Bin size:    " << fileSize("iotest.bin")/1000000. << " MB" << endl
+	     << "  Bin write:   " << seconds(tbeg,tend) << " s" << endl;
+
+	gettimeofday(&tbeg,NULL);
+	{ ifstream in("iotest.bin", ios::binary);
+	  StreamInput sin(in);
+	  readBinaryHeader(sin, context, type);
+	  readBinary(sin, copy); }
+	gettimeofday(&tend,NULL);
+	match = match && (copy == obj);
+	cout << "  Bin read:    " << seconds(tbeg,tend) << " s" << endl;
+
+	gettimeofday(&tbeg,NULL);
+	{ MappedFile file("iotest.bin");
+	  MemoryInput min(file.getData(), file.size());
+	  readBinaryHeader(min, context, type);
+	  readBinary(min, copy); }
+	gettimeofday(&tend,NULL);
+	match = match && (copy == obj);
+	cout << "  Mmap read:   " << seconds(tbeg,tend) << " s" << endl
+	     << "  Match:       " << (match?"true":"false") << endl;
+}
+
+int main()
+{
+	SetSeed(ZZ(0));
+	struct timeval tbeg, tend;
+
+	cout << endl
+		 << "***************************" << endl
+		 << "*        Test I/O         *" << endl
+		 << "***************************" << endl;
+	cout << "   Parameters"               << endl
+	     << "---------------------------" << endl
+	     << "  m:           " << m 				  << endl
+	     << "  depth:       " << lvl 			  << endl
+	     << "  nPrms:       " << nPrms 			  << endl
+	     << "  nDgts:       " << nDgts 			  << endl;
+	FHEcontext context(m, plaintextModulus);
+	buildModChain(context, lvl, nDgts, nHlfPrmsByLvl);
+
+	FHESecKey secretKey(context);
+	const FHEPubKey& publicKey = secretKey;
+	secretKey.GenSecKey(32, plaintextModulus);
+	Ctxt c(publicKey);
+	secretKey.Encrypt(c, to_ZZX(plaintextModulus-1), plaintextModulus);
+
+	/*
+	 * Context
+	 */
+	cout << "===========================" << endl
+	     << "   Context"                  << endl
+	     << "---------------------------" << endl;
+	{
+		stringstream str;
+		gettimeofday(&tbeg,NULL);
+		writeContextBinary(str, context);
+		StreamInput in(str);
+		unsigned long m1;
+		ZZ p1;
+		readContextBaseBinary(in, m1, p1);
+		FHEcontext context2(m1, p1);
+		readContextBinary(in, context2);
+		gettimeofday(&tend,NULL);
+		cout << "  Round trip:  " << seconds(tbeg,tend) << " s" << endl
+		     << "  Match:       " << ((context2==context)?"true":"false") << endl;
+	}
+
+	/*
+	 * Ciphertext and keys (the text format of FHEPubKey cannot be read
+	 * back with BIG_P, see readContextBase)
+	 */
+	Ctxt c2(publicKey);
+	roundTrip("Ctxt", c, c2, BIN_CTXT, /*readText=*/true);
+	FHEPubKey publicKey2(context);
+	roundTrip("Public key", publicKey, publicKey2, BIN_PUBKEY, false);
+
+	/*
+	 * A deployment snapshot, compared with building the context anew
+	 */
+	cout << "===========================" << endl
+	     << "   Snapshot"                 << endl
+	     << "---------------------------" << endl;
+	{
+		gettimeofday(&tbeg,NULL);
+		{ ofstream out("iotest.bin", ios::binary);
+		  writeSnapshot(out, publicKey); }
+		gettimeofday(&tend,NULL);
+		cout << "  Size:        " << fileSize("iotest.bin")/1000000. << " MB" << endl
+		     << "  Write:       " << seconds(tbeg,tend) << " s" << endl;
+
+		gettimeofday(&tbeg,NULL);
+		{ FHEcontext context2(m, plaintextModulus);
+		  buildModChain(context2, lvl, nDgts, nHlfPrmsByLvl); }
+		gettimeofday(&tend,NULL);
+		cout << "  Rebuild ctx: " << seconds(tbeg,tend) << " s" << endl;
+
+		gettimeofday(&tbeg,NULL);
+		Snapshot snap("iotest.bin");
+		gettimeofday(&tend,NULL);
+		stringstream pk1, pk2;
+		writeBinary(pk1, publicKey);
+		writeBinary(pk2, snap.getPubKey());
+		cout << "  Load:        " << seconds(tbeg,tend) << " s" << endl
+		     << "  Match:       " << ((snap.getContext()==context && pk1.str()==pk2.str())?"true":"false") << endl;
+	}
+
+	/*
+	 * A view over a memory-mapped ciphertext, used without copying it
+	 */
+	cout << "===========================" << endl
+	     << "   Ctxt view"                << endl
+	     << "---------------------------" << endl;
+	{
+		{ ofstream out("iotest.bin", ios::binary);
+		  writeBinaryHeader(out, context, BIN_CTXT);
+		  writeBinary(out, c); }
+		Ctxt d(publicKey);
+		secretKey.Encrypt(d, to_ZZX(2), plaintextModulus);
+		Ctxt prod(d), prod2(d);
+		prod2 *= c;
+
+		MappedFile file("iotest.bin");
+		MemoryInput min(file.getData(), file.size());
+		gettimeofday(&tbeg,NULL);
+		readBinaryHeader(min, context, BIN_CTXT);
+		CtxtView view = readBinaryView(min, publicKey);
+		gettimeofday(&tend,NULL);
+		cout << "  View read:   " << seconds(tbeg,tend) << " s" << endl;
+
+		gettimeofday(&tbeg,NULL);
+		prod *= view;
+		gettimeofday(&tend,NULL);
+		cout << "  Mul:         " << seconds(tbeg,tend) << " s" << endl;
+
+		ZZX ptxt, ptxt2;
+		gettimeofday(&tbeg,NULL);
+		secretKey.Decrypt(ptxt, view);
+		gettimeofday(&tend,NULL);
+		secretKey.Decrypt(ptxt2, c);
+		cout << "  Decrypt:     " << seconds(tbeg,tend) << " s" << endl
+		     << "  Match:       " << ((ptxt==ptxt2 && prod==prod2)?"true":"false") << endl;
+	}
+
+	/*
+	 * A stream of ciphertexts, read back in batches of bounded size
+	 */
+	cout << "===========================" << endl
+	     << "   Ctxt stream"              << endl
+	     << "---------------------------" << endl;
+	{
+		const long nCtxts = 64, batch = 16;
+		vector<Ctxt> v(nCtxts, c);
+		gettimeofday(&tbeg,NULL);
+		{ ofstream out("iotest.bin", ios::binary);
+		  CtxtStreamWriter writer(out, context);
+		  writer.write(v); }
+		gettimeofday(&tend,NULL);
+		double mb = nCtxts*context.logOfProduct(c.getPrimeSet())/log(2)
+		  /1000000.*context.zMStar.getPhiM()*2;
+		cout << "  Write:       " << seconds(tbeg,tend) << " s" << endl
+		     << "  Write rate:  " << mb/seconds(tbeg,tend) << " Mbps" << endl;
+
+		bool match = true;
+		long count = 0;
+		ifstream in("iotest.bin", ios::binary);
+		StreamInput sin(in);
+		gettimeofday(&tbeg,NULL);
+		CtxtStreamReader reader(sin, publicKey);
+		vector<Ctxt> w;
+		while (long n = reader.read(w, batch)) {
+			for (long i = 0; i < n; i++) match = match && (w[i] == c);
+			count += n;
+		}
+		gettimeofday(&tend,NULL);
+		cout << "  Read:        " << seconds(tbeg,tend) << " s" << endl
+		     << "  Read rate:   " << mb/seconds(tbeg,tend) << " Mbps" << endl
+		     << "  Match:       " << ((match && count==nCtxts)?"true":"false") << endl;
+	}
+	cout << "===========================" << endl;
+
+	unlink("iotest.txt"); // clean up before exiting
+	unlink("iotest.bin");
+}
+#else
 #define N_TESTS 3
 static long ms[N_TESTS][10] = {
   //nSlots  m   phi(m) ord(2)
@@ -255,6 +494,7 @@ int main(int argc, char *argv[])
   }}
   unlink("iotest.txt"); // clean up before exiting
 }
+#endif // BIG_P
 
 #if 0
 /************************ OLD CODE ************************/
@@ -77,6 +77,90 @@ int main() {
 	     << "  Rate:        " << (context.logOfProduct(c[0]->getPrimeSet())/log(2)/1000000.*context.zMStar.getPhiM())/(texe/((double)(2048/WNDW))) << " Mbps" << std::endl;
 
 
+	/*
+	 * Residue storage
+	 */
+	cout << "==========================="    << endl
+	     << "   " << 2048/WNDW << " Storage" << endl
+	     << "---------------------------"    << endl;
+	{
+		double wide = 0, narrow = 0;
+		for (unsigned i = 0; i < 2048/WNDW; i++)
+			for (unsigned j = 0; j < c[i]->parts.size(); j++)
+				wide += card(c[i]->parts[j].getIndexSet())*context.zMStar.getPhiM()*8.;
+		cout << "  nPrms:       " << context.numPrimes() << endl
+		     << "  64-bit:      " << wide/1000000. << " MB" << endl;
+		if (CompactDoubleCRT::fits(context)) {
+			vector<CompactDoubleCRT> packed;
+			gettimeofday(&tbeg,NULL);
+			for (unsigned i = 0; i < 2048/WNDW; i++)
+				for (unsigned j = 0; j < c[i]->parts.size(); j++) {
+					packed.push_back(CompactDoubleCRT(c[i]->parts[j]));
+					narrow += packed.back().bytes();
+				}
+			gettimeofday(&tend,NULL);
+			texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+			cout << "  32-bit:      " << narrow/1000000. << " MB" << endl
+			     << "  Pack:        " << texe << " s" << endl;
+
+			gettimeofday(&tbeg,NULL);
+			for (unsigned i = 0; i+1 < packed.size(); i+=2)
+				packed[i] *= packed[i+1];
+			gettimeofday(&tend,NULL);
+			texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+			cout << "  Mul 32-bit:  " << texe << " s" << endl;
+
+			gettimeofday(&tbeg,NULL);
+			for (unsigned i = 0; i < 2048/WNDW; i++) {
+				DoubleCRT tmp = c[i]->parts[0];
+				tmp *= c[i]->parts[1];
+			}
+			gettimeofday(&tend,NULL);
+			texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+			cout << "  Mul 64-bit:  " << texe << " s (incl. copy)" << endl;
+		}
+		else
+			cout << "  32-bit:      n/a (compile with -DFHE_SMALL_PRIMES)" << endl;
+	}
+
+
+	/*
+	 * Batch of independent multiplications, thread scaling
+	 */
+	cout << "===========================" << endl
+	     << "   " << 2048/(2*WNDW) << " Mul. (batch)" << endl
+	     << "---------------------------" << endl;
+#ifndef FHE_CTXT_THREADS
+	cout << "  (sequential, compile with -DFHE_CTXT_THREADS)" << endl;
+#endif
+	{
+		double t1 = 0;
+		for (long nt = 1; nt <= 32; nt *= 2) {
+			vector<Ctxt> a, b;
+			for (unsigned i = 0; i < 2048/WNDW; i+=2) {
+				a.push_back(*c[i]);
+				b.push_back(*c[i+1]);
+			}
+			vector<Ctxt*> dst;
+			vector<const Ctxt*> src;
+			for (unsigned i = 0; i < a.size(); i++) {
+				dst.push_back(&a[i]);
+				src.push_back(&b[i]);
+			}
+			setNumThreads(nt); // multiplyPairs uses at most the pool size
+			long eff = getNumThreads();
+			gettimeofday(&tbeg,NULL);
+			multiplyPairs(dst, src, nt);
+			gettimeofday(&tend,NULL);
+			texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+			if (nt == 1) t1 = texe;
+			cout << "  " << eff << " threads:" << ((eff<10)? "   " : "  ")
+			     << texe << " s, " << a.size()/texe << " Mul/s (x" << t1/texe << ")" << endl;
+		}
+		setNumThreads(0); // back to the default
+	}
+
+
 	/*
 	 * Multiplications
 	 */
@@ -88,15 +172,12 @@ int main() {
 	cout << ((2048/(2*WNDW))>>(hght-1)) << " Mul." << endl
 	     << "---------------------------"          << endl;
 	gettimeofday(&tbeg,NULL);
-	long k;
-	for (k=2; k<(1<<(hght+1)); k<<=1) {
-		for (unsigned i=0; i<2048/WNDW; i+=k) {
-			c[i]->multiplyBy(*c[i+k/2]);
-			Debug(cout << "." << flush);
-			Debug(for(unsigned j=0; j<k-1; j++)cout << " " << flush);
-		}
-		Debug(cout << endl);
-	}
+	long k = 1<<(hght+1); // the results are in the c[i]'s with k/2 | i
+	reductionTree(2048/WNDW,
+		[&](long i, long j) {
+			c[i]->multiplyBy(*c[j]);
+			c[j]->clear();
+		}, /*nthreads=*/0, /*maxDepth=*/hght);
 	gettimeofday(&tend,NULL);
 	texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
 	cout << "  Time:        " << texe << " s" << std::endl
@@ -131,7 +212,29 @@ int main() {
          << "  Time:        " << texe << " s" << std::endl
 	     << "  Avg:         " << texe/(double)(2048/WNDW/(k/2)) << " s" << endl
 	     << "  Size:        " << context.logOfProduct(c[0]->getPrimeSet())/log(2)/1000000.*context.zMStar.getPhiM()*((double)((2048/WNDW)/(k/2)))*2. << " Mb" << std::endl
-	     << "  Rate:        " << (context.logOfProduct(c[0]->getPrimeSet())/log(2)/1000000.*context.zMStar.getPhiM())*((double)((2048/WNDW)/(k/2)))*2./texe << " Mbps" << std::endl
+	     << "  Rate:        " << (context.logOfProduct(c[0]->getPrimeSet())/log(2)/1000000.*context.zMStar.getPhiM())*((double)((2048/WNDW)/(k/2)))*2./texe << " Mbps" << std::endl;
+
+	/*
+	 * Constant-coefficient decryptions
+	 */
+	// The reference is the constant coefficient given by Decrypt for the
+	// same ciphertext, computed outside of the timed loop
+	vector<ZZ> ref;
+	for(unsigned i = 0; i < 2048/WNDW; i+=k/2) {
+		secretKey.Decrypt(p, *c[i]);
+		ref.push_back(coeff(p, 0));
+	}
+	ZZ p0;
+	bool coeffOk = true;
+	gettimeofday(&tbeg,NULL);
+	for(unsigned i = 0, j = 0; i < 2048/WNDW; i+=k/2, j++) {
+		secretKey.DecryptCoeffs(p0, *c[i]);
+		coeffOk = coeffOk && (p0 == ref[j]);
+	}
+	gettimeofday(&tend,NULL);
+	texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+	cout << "  Coeff 0:     " << (coeffOk?"true":"false") << ", "
+	     << texe/(double)(2048/WNDW/(k/2)) << " s" << endl
          << "===========================" << endl;
 
 
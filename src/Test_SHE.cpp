@@ -8,6 +8,7 @@
 #include <time.h>
 #include <ctime>
 #include <fstream>
+#include <sstream>
 #include "Util.h"
 #include "DoubleCRT.h"
 #include "NTL/ZZ_pX.h"
@@ -42,13 +43,42 @@ int main() {
 	 * Keys Generation
 	 */
 	cout << "===========================" << endl
-	     << "   KeyGen"                   << endl;
+	     << "   KeyGen"                   << endl
+	     << "---------------------------" << endl;
 	FHESecKey secretKey(context);
 	const FHEPubKey& publicKey = secretKey;
+	gettimeofday(&tbeg,NULL);
 	secretKey.GenSecKey(32, plaintextModulus); // A Hamming-weight-w secret key
+	gettimeofday(&tend,NULL);
+	texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+	cout << "  Time:        " << texe << " s" << endl;
 	ZZX p = to_ZZX(plaintextModulus-1);
 	Ctxt *c = new Ctxt(publicKey);
 
+	/*
+	 * Products by the (sparse) secret key
+	 */
+	cout << "===========================" << endl
+	     << "   s*a (hwt 32)"             << endl
+	     << "---------------------------" << endl;
+	{
+		ZZX a, sparse, dense;
+		for (long j = 0; j < context.zMStar.getPhiM(); j++)
+			SetCoeff(a, j, RandomBnd(plaintextModulus));
+		gettimeofday(&tbeg,NULL);
+		secretKey.mulByKey(sparse, a, 0, /*allowSparse=*/true);
+		gettimeofday(&tend,NULL);
+		texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+		cout << "  Sparse:      " << texe << " s"
+		     << (secretKey.hasSparseKey()? "" : " (no sparse key)") << endl;
+		gettimeofday(&tbeg,NULL);
+		secretKey.mulByKey(dense, a, 0, /*allowSparse=*/false);
+		gettimeofday(&tend,NULL);
+		texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+		cout << "  DoubleCRT:   " << texe << " s" << endl
+		     << "  Match:       " << ((sparse==dense)?"true":"false") << endl;
+	}
+
 	/*
 	 * Encryptions
 	 */
@@ -68,23 +98,106 @@ int main() {
 	     << "  Size:        " << context.logOfProduct(c->getPrimeSet())/log(2)/1000000.*context.zMStar.getPhiM()*2 << " Mb" << std::endl
 	     << "  Rate:        " << (context.logOfProduct(c->getPrimeSet())/log(2)/1000000.*context.zMStar.getPhiM())*2/(texe/((double)(repeti))) << " Mbps" << std::endl;
 
+	/*
+	 * Seeded encryptions: only the seed and c0 are sent, c1 is rebuilt
+	 * on the other side. The rate is in Mb of full ciphertexts, as above.
+	 */
+	cout << "===========================" << endl
+	     << "   Seeded encrypt"           << endl
+	     << "---------------------------" << endl;
+	{
+		SeededCtxt sc(publicKey), sc2(publicKey);
+		Ctxt expanded(publicKey);
+		stringstream str;
+		gettimeofday(&tbeg,NULL);
+		for(long i = 0; i < repeti; i++){
+			secretKey.Encrypt(sc, p, plaintextModulus);
+			str.str("");
+			writeBinary(str, sc);
+		}
+		gettimeofday(&tend,NULL);
+		texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+		double fullMb = context.logOfProduct(sc.getPrimeSet())/log(2)/1000000.*context.zMStar.getPhiM()*2;
+		double seededMb = fullMb/2 + SeededCtxt::seedBits/1000000.;
+		cout << "  Time:        " << texe/(double)repeti << " s" << endl
+		     << "  Size:        " << seededMb << " Mb" << endl
+		     << "  Bin size:    " << str.str().size()*8/1000000. << " Mb" << endl
+		     << "  Rate:        " << fullMb/(texe/((double)(repeti))) << " Mbps" << endl;
+
+		gettimeofday(&tbeg,NULL);
+		for(long i = 0; i < repeti; i++){
+			str.seekg(0);
+			StreamInput in(str);
+			readBinary(in, sc2);
+			sc2.expand(expanded);
+		}
+		gettimeofday(&tend,NULL);
+		texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+		ZZX dec;
+		secretKey.Decrypt(dec, expanded);
+		cout << "  Expand:      " << texe/(double)repeti << " s" << endl
+		     << "  Match:       " << ((dec==p)?"true":"false") << endl;
+	}
+
 
 	/*
 	 * Multiplications
 	 */
+	Ctxt fused = *c; // the same squarings, relinearized with reLinearizeDown
+	Ctxt steady = *c; // to count row allocations once the pool is warm
 	cout << "===========================" << endl
 	     << "   " << lvl << " Mul. (1 per lvl)"       << endl
 	     << "---------------------------" << endl;
+	double ttensor = 0;
+	texe = 0;
 	gettimeofday(&tbeg,NULL);
 	for (int i=0; i<lvl; i++) {
-		c->multiplyBy(*c);
+		struct timeval tmul;
+		*c *= *c; // mod-down and tensor (squaring: 3 products)
+		gettimeofday(&tmul,NULL);
+		ttensor += ((double)(tmul.tv_sec-tbeg.tv_sec)) + ((double)(tmul.tv_usec-tbeg.tv_usec))/1000000.;
+		c->reLinearize();
 		Debug(cout << "." << flush);
+		gettimeofday(&tend,NULL);
+		texe += ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+		tbeg = tend;
 	}
 	Debug(cout << endl);
-	gettimeofday(&tend,NULL);
-	texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
 	cout << "  Time:        " << texe << " s" << std::endl;
 	cout << "  Avg:         " << texe/lvl << " s" << std::endl;
+	cout << "  Avg tensor:  " << ttensor/lvl << " s" << std::endl;
+	gettimeofday(&tbeg,NULL);
+	for (int i=0; i<lvl; i++)
+		fused.multiplyBy(fused, /*modDown=*/true);
+	gettimeofday(&tend,NULL);
+	texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+	cout << "  Avg fused:   " << texe/lvl << " s" << std::endl;
+	if (lvl > 1) {
+		steady.multiplyBy(steady); // warm up the row pool
+		DCRTRowPool::resetCounters();
+		steady.multiplyBy(steady);
+		cout << "  Row allocs:  " << DCRTRowPool::allocated() << " ("
+		     << DCRTRowPool::reused() << " reused)" << std::endl;
+	}
+	{
+		// Same check with a long chain (~900 primes), where the live rows
+		// of a few DoubleCRT objects are in the thousands
+		FHEcontext big(m, plaintextModulus);
+		buildModChainByTotal(big, 1800, nDgts);
+		DoubleCRT a(big), b(big);
+		a.randomize();
+		b.randomize();
+		for (int i=0; i<2; i++) {
+			if (i == 1) DCRTRowPool::resetCounters(); // warm after one pass
+			DoubleCRT t(a), u(b);
+			t *= b;
+			u += t;
+			u *= a;
+		}
+		cout << "  Long chain:  " << big.numPrimes() << " primes, "
+		     << DCRTRowPool::allocated() << " row allocs ("
+		     << DCRTRowPool::reused() << " reused)" << std::endl;
+	}
 
 
 	/*
@@ -112,6 +225,33 @@ int main() {
 		 << "  Correctness: " << ((p[0]==to_ZZ(1))?"true":"false") << endl
          << "  Time:        " << texe/(double)repeti << " s" << std::endl
 	     << "  Size:        " << context.logOfProduct(c->getPrimeSet())/log(2)/1000000.*context.zMStar.getPhiM()*2. << " Mb" << std::endl
-	     << "  Rate:        " << (context.logOfProduct(c->getPrimeSet())/log(2)/1000000.*context.zMStar.getPhiM())*((double)repeti)*2./texe << " Mbps" << std::endl
-         << "===========================" << endl;
+	     << "  Rate:        " << (context.logOfProduct(c->getPrimeSet())/log(2)/1000000.*context.zMStar.getPhiM())*((double)repeti)*2./texe << " Mbps" << std::endl;
+
+	/*
+	 * Transport: switch to the smallest modulus that still decrypts and
+	 * bit-pack the coefficients
+	 */
+	cout << "===========================" << endl
+	     << "   Transport"                << endl
+	     << "---------------------------" << endl;
+	{
+		PackedCtxt packed(publicKey);
+		gettimeofday(&tbeg,NULL);
+		for(long i = 0; i < repeti; i++)
+			c->squashForTransport(packed);
+		gettimeofday(&tend,NULL);
+		texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+		cout << "  log2 q':     " << packed.getBits() << endl
+		     << "  Size:        " << packed.bytes()*8/1000000. << " Mb" << endl
+		     << "  Squash:      " << texe/(double)repeti << " s" << endl;
+
+		gettimeofday(&tbeg,NULL);
+		for(long i = 0; i < repeti; i++)
+			secretKey.Decrypt(p, packed);
+		gettimeofday(&tend,NULL);
+		texe = ((double)(tend.tv_sec-tbeg.tv_sec)) + ((double)(tend.tv_usec-tbeg.tv_usec))/1000000.;
+		cout << "  Decrypt:     " << texe/(double)repeti << " s" << endl
+		     << "  Match:       " << ((p[0]==to_ZZ(1))?"true":"false") << endl;
+	}
+	cout << "===========================" << endl;
 }
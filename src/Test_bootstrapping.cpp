@@ -264,7 +264,7 @@ int main(int argc, char *argv[])
   amap.parse(argc, argv);
 
 #ifdef FHE_BOOT_THREADS
-  bootTask = new MultiTask(nthreads);
+  setNumThreads(nthreads);
   cout << "*** nthreads = " << nthreads << "\n";
 #else
   cout << "*** no threads\n";
@@ -0,0 +1,1064 @@
+/* Copyright (C) 2012,2013 IBM Corp.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+/* binio.cpp - binary I/O of contexts, keys and ciphertexts
+ */
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "binio.h"
+#include "FHE.h"
+#include "timing.h"
+
+static const char binMagic[8] = {'H','E','l','i','b','M','P','\0'};
+
+static bool hostIsLittleEndian()
+{
+  const unsigned long one = 1;
+  return *((const unsigned char*) &one) == 1;
+}
+
+/******************** Input sources **********************/
+
+void StreamInput::get(void* dst, size_t n)
+{
+  if (!str.read((char*) dst, n))
+    Error("StreamInput::get: unexpected end of input");
+}
+
+void MemoryInput::get(void* dst, size_t n)
+{
+  memcpy(dst, skip(n), n);
+}
+
+const void* MemoryInput::skip(size_t n)
+{
+  if ((size_t)(end-pos) < n)
+    Error("MemoryInput::skip: unexpected end of input");
+  const void* p = pos;
+  pos += n;
+  return p;
+}
+
+MappedFile::MappedFile(const string& fileName): data(NULL), len(0)
+{
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) Error("MappedFile: cannot open file");
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    Error("MappedFile: cannot stat file");
+  }
+  len = st.st_size;
+  if (len > 0) {
+    data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      Error("MappedFile: mmap failed");
+    }
+  }
+  close(fd); // the mapping remains valid after the file is closed
+}
+
+MappedFile::~MappedFile()
+{
+  if (data != NULL) munmap(data, len);
+}
+
+/******************** Raw words **********************/
+
+void write_raw_long(ostream& str, long x)
+{
+  unsigned char buf[8];
+  unsigned long u = x;
+  for (long i = 0; i < 8; i++, u >>= 8)
+    buf[i] = (unsigned char) u;
+  str.write((const char*) buf, 8);
+}
+
+long read_raw_long(BinaryInput& in)
+{
+  unsigned char buf[8];
+  in.get(buf, 8);
+  unsigned long u = 0;
+  for (long i = 7; i >= 0; i--)
+    u = (u << 8) | buf[i];
+  return (long) u;
+}
+
+// The length of a vector, with a sanity check against corrupted input
+static long read_raw_length(BinaryInput& in)
+{
+  long n = read_raw_long(in);
+  if (n < 0 || n > (1L << 32))
+    Error("read_raw_length: invalid length");
+  return n;
+}
+
+void write_raw_ZZ(ostream& str, const ZZ& x)
+{
+  long n = NumBytes(x);
+  write_raw_long(str, (sign(x)<0)? -n : n);
+
+  long padded = 8*((n+7)/8);
+  if (padded == 0) return;
+  vector<unsigned char> buf(padded, 0);
+  BytesFromZZ(&buf[0], x, n); // the bytes of |x|
+  str.write((const char*) &buf[0], padded);
+}
+
+void read_raw_ZZ(BinaryInput& in, ZZ& x)
+{
+  long n = read_raw_long(in);
+  bool negative = (n < 0);
+  if (negative) n = -n;
+  if (n > (1L << 32))
+    Error("read_raw_ZZ: invalid length");
+
+  long padded = 8*((n+7)/8);
+  if (padded == 0) {
+    clear(x);
+    return;
+  }
+  vector<unsigned char> buf(padded);
+  in.get(&buf[0], padded);
+  ZZFromBytes(x, &buf[0], n);
+  if (negative) NTL::negate(x, x);
+}
+
+void write_raw_xdouble(ostream& str, const xdouble& x)
+{
+  long bits;
+  memcpy(&bits, &x.x, 8); // the mantissa
+  write_raw_long(str, bits);
+  write_raw_long(str, x.e);
+}
+
+void read_raw_xdouble(BinaryInput& in, xdouble& x)
+{
+  long bits = read_raw_long(in);
+  memcpy(&x.x, &bits, 8);
+  x.e = read_raw_long(in);
+}
+
+void write_raw_IndexSet(ostream& str, const IndexSet& s)
+{
+  write_raw_long(str, card(s));
+  for (long i = s.first(); i <= s.last(); i = s.next(i))
+    write_raw_long(str, i);
+}
+
+void read_raw_IndexSet(BinaryInput& in, IndexSet& s)
+{
+  long n = read_raw_length(in);
+  s.clear();
+  for (long j = 0; j < n; j++) {
+    long i = read_raw_long(in);
+    if (i < 0) Error("read_raw_IndexSet: negative index");
+    s.insert(i);
+  }
+}
+
+void write_raw_row(ostream& str, const long* row, long n)
+{
+  if (sizeof(long) == 8 && hostIsLittleEndian())
+    str.write((const char*) row, 8*n);
+  else
+    for (long j = 0; j < n; j++) write_raw_long(str, row[j]);
+}
+
+void read_raw_row(BinaryInput& in, long* row, long n)
+{
+  if (sizeof(long) == 8 && hostIsLittleEndian())
+    in.get(row, 8*n);
+  else
+    for (long j = 0; j < n; j++) row[j] = read_raw_long(in);
+}
+
+/******************** Headers **********************/
+
+// FNV-1a over the bytes of w
+static void hashWord(unsigned long& h, unsigned long w)
+{
+  for (long i = 0; i < 8; i++, w >>= 8) {
+    h ^= (w & 0xff);
+    h *= 1099511628211UL;
+  }
+}
+
+unsigned long contextFingerprint(const FHEcontext& context)
+{
+  unsigned long h = 14695981039346656037UL;
+  hashWord(h, context.zMStar.getM());
+
+#ifndef BIG_P
+  hashWord(h, context.alMod.getPPowR());
+#else
+  const ZZ& p = context.ModulusP();
+  long n = NumBytes(p);
+  vector<unsigned char> buf(n+1);
+  BytesFromZZ(&buf[0], p, n);
+  hashWord(h, n);
+  for (long i = 0; i < n; i++) hashWord(h, buf[i]);
+#endif
+
+  hashWord(h, context.numPrimes());
+  for (long i = 0; i < context.numPrimes(); i++) {
+    hashWord(h, context.ithPrime(i));
+    hashWord(h, context.specialPrimes.contains(i));
+  }
+  hashWord(h, context.digits.size());
+  for (long i = 0; i < (long)context.digits.size(); i++) {
+    const IndexSet& s = context.digits[i];
+    hashWord(h, card(s));
+    for (long j = s.first(); j <= s.last(); j = s.next(j))
+      hashWord(h, j);
+  }
+  return h;
+}
+
+void writeBinaryHeader(ostream& str, const FHEcontext& context, long type)
+{
+  str.write(binMagic, 8);
+  write_raw_long(str, BINIO_VERSION);
+  write_raw_long(str, type);
+  write_raw_long(str, (long) contextFingerprint(context));
+}
+
+// Check the magic string, version and type, and return the fingerprint
+static unsigned long readHeaderWords(BinaryInput& in, long type)
+{
+  char magic[8];
+  in.get(magic, 8);
+  if (memcmp(magic, binMagic, 8) != 0)
+    Error("readBinaryHeader: not a binary HElib file");
+  if (read_raw_long(in) != BINIO_VERSION)
+    Error("readBinaryHeader: unsupported format version");
+  if (read_raw_long(in) != type)
+    Error("readBinaryHeader: wrong object type");
+  return (unsigned long) read_raw_long(in);
+}
+
+void readBinaryHeader(BinaryInput& in, const FHEcontext& context, long type)
+{
+  if (readHeaderWords(in, type) != contextFingerprint(context))
+    Error("readBinaryHeader: the object was written for another context");
+}
+
+/******************** DoubleCRT and ciphertexts **********************/
+
+void writeBinary(ostream& str, const DoubleCRT& d)
+{
+  const IndexSet& set = d.map.getIndexSet();
+  long phim = d.context.zMStar.getPhiM();
+
+  write_raw_IndexSet(str, set); // the prime-index table
+  for (long i = set.first(); i <= set.last(); i = set.next(i))
+    write_raw_row(str, d.map[i].elts(), phim);
+}
+
+// Unlike operator>>, the residues are not checked one by one: the header
+// guarantees that the data was written for the same chain of primes
+void readBinary(BinaryInput& in, DoubleCRT& d)
+{
+  FHE_TIMER_START;
+  const FHEcontext& context = d.context;
+  long phim = context.zMStar.getPhiM();
+
+  IndexSet set;
+  read_raw_IndexSet(in, set);
+  if (!(set <= (context.specialPrimes | context.ctxtPrimes)))
+    Error("readBinary: DoubleCRT primes are not in the chain");
+
+  d.map.clear();
+  d.map.insert(set); // fix the index set for the data
+  for (long i = set.first(); i <= set.last(); i = set.next(i))
+    read_raw_row(in, d.map[i].elts(), phim);
+}
+
+void writeBinary(ostream& str, const SKHandle& handle)
+{
+  write_raw_long(str, handle.getPowerOfS());
+  write_raw_long(str, handle.getPowerOfX());
+  write_raw_long(str, handle.getSecretKeyID());
+}
+
+void readBinary(BinaryInput& in, SKHandle& handle)
+{
+  long powerOfS = read_raw_long(in);
+  long powerOfX = read_raw_long(in);
+  long secretKeyID = read_raw_long(in);
+  handle = SKHandle(powerOfS, powerOfX, secretKeyID);
+}
+
+void writeBinary(ostream& str, const CtxtPart& p)
+{
+  writeBinary(str, (const DoubleCRT&) p);
+  writeBinary(str, p.skHandle);
+}
+
+void readBinary(BinaryInput& in, CtxtPart& p)
+{
+  readBinary(in, (DoubleCRT&) p);
+  readBinary(in, p.skHandle);
+}
+
+void writeBinary(ostream& str, const Ctxt& ctxt)
+{
+#ifndef BIG_P
+  write_raw_long(str, ctxt.ptxtSpace);
+#else
+  write_raw_ZZ(str, ctxt.ptxtSpace);
+#endif
+  write_raw_xdouble(str, ctxt.noiseVar);
+  write_raw_IndexSet(str, ctxt.primeSet);
+  write_raw_long(str, ctxt.parts.size());
+  for (size_t i=0; i<ctxt.parts.size(); i++)
+    writeBinary(str, ctxt.parts[i]);
+}
+
+void readBinary(BinaryInput& in, Ctxt& ctxt)
+{
+#ifndef BIG_P
+  ctxt.ptxtSpace = read_raw_long(in);
+#else
+  read_raw_ZZ(in, ctxt.ptxtSpace);
+#endif
+  read_raw_xdouble(in, ctxt.noiseVar);
+  read_raw_IndexSet(in, ctxt.primeSet);
+
+  long nParts = read_raw_length(in);
+  ctxt.parts.resize(nParts, CtxtPart(ctxt.context,IndexSet::emptySet()));
+  for (long i=0; i<nParts; i++) {
+    readBinary(in, ctxt.parts[i]);
+    if (ctxt.parts[i].getIndexSet() != ctxt.primeSet)
+      Error("readBinary: ciphertext parts do not match its primeSet");
+  }
+}
+
+void writeBinary(ostream& str, const SeededCtxt& ctxt)
+{
+#ifndef BIG_P
+  write_raw_long(str, ctxt.ptxtSpace);
+#else
+  write_raw_ZZ(str, ctxt.ptxtSpace);
+#endif
+  write_raw_xdouble(str, ctxt.noiseVar);
+  write_raw_long(str, ctxt.keyID);
+  write_raw_ZZ(str, ctxt.seed);
+  writeBinary(str, ctxt.c0);
+}
+
+void readBinary(BinaryInput& in, SeededCtxt& ctxt)
+{
+#ifndef BIG_P
+  ctxt.ptxtSpace = read_raw_long(in);
+#else
+  read_raw_ZZ(in, ctxt.ptxtSpace);
+#endif
+  read_raw_xdouble(in, ctxt.noiseVar);
+  ctxt.keyID = read_raw_long(in);
+  read_raw_ZZ(in, ctxt.seed);
+  readBinary(in, ctxt.c0);
+}
+
+void writeBinary(ostream& str, const PackedCtxt& ctxt)
+{
+#ifndef BIG_P
+  write_raw_long(str, ctxt.ptxtSpace);
+#else
+  write_raw_ZZ(str, ctxt.ptxtSpace);
+#endif
+  write_raw_ZZ(str, ctxt.modulus);
+  write_raw_long(str, ctxt.keyID);
+  write_raw_long(str, ctxt.nBits);
+  write_raw_long(str, ctxt.words.size());
+  write_raw_row(str, (const long*) ctxt.words.data(), ctxt.words.size());
+}
+
+void readBinary(BinaryInput& in, PackedCtxt& ctxt)
+{
+#ifndef BIG_P
+  ctxt.ptxtSpace = read_raw_long(in);
+#else
+  read_raw_ZZ(in, ctxt.ptxtSpace);
+#endif
+  read_raw_ZZ(in, ctxt.modulus);
+  ctxt.keyID = read_raw_long(in);
+  ctxt.nBits = read_raw_long(in);
+  long phim = ctxt.pubKey->getContext().zMStar.getPhiM();
+  long n = read_raw_length(in);
+  if (ctxt.nBits <= 1 || NumBits(ctxt.modulus) > ctxt.nBits
+      || n != (2*phim*ctxt.nBits + 63)/64)
+    Error("readBinary: bad packed ciphertext");
+  ctxt.words.resize(n);
+  read_raw_row(in, (long*) ctxt.words.data(), n);
+}
+
+// The rows of each part are contiguous in the file, so the views point
+// directly into the buffer
+CtxtView readBinaryView(MemoryInput& in, const FHEPubKey& pk)
+{
+  if (sizeof(long) != 8 || !hostIsLittleEndian())
+    Error("readBinaryView: needs a little-endian host with 64-bit longs");
+  const FHEcontext& context = pk.getContext();
+  long phim = context.zMStar.getPhiM();
+
+#ifndef BIG_P
+  long ptxtSpace = read_raw_long(in);
+#else
+  ZZ ptxtSpace;
+  read_raw_ZZ(in, ptxtSpace);
+#endif
+  xdouble noiseVar;
+  read_raw_xdouble(in, noiseVar);
+  IndexSet primeSet;
+  read_raw_IndexSet(in, primeSet);
+
+  long nParts = read_raw_length(in);
+  vector<CtxtPartView> parts(nParts);
+  for (long i=0; i<nParts; i++) {
+    IndexSet set;
+    read_raw_IndexSet(in, set);
+    if (set != primeSet)
+      Error("readBinaryView: ciphertext parts do not match its primeSet");
+    const void* rows = in.skip(8*phim*card(set));
+    if (((unsigned long) rows) % 8 != 0)
+      Error("readBinaryView: the buffer is not aligned");
+    SKHandle handle;
+    readBinary(in, handle);
+    parts[i] = CtxtPartView(context, set, (const long*) rows, handle);
+  }
+  return CtxtView(pk, primeSet, ptxtSpace, noiseVar, parts);
+}
+
+/******************** Keys **********************/
+
+void writeBinary(ostream& str, const KeySwitch& matrix)
+{
+  writeBinary(str, matrix.fromKey);
+  write_raw_long(str, matrix.toKeyID);
+#ifndef BIG_P
+  write_raw_long(str, matrix.ptxtSpace);
+#else
+  write_raw_ZZ(str, matrix.ptxtSpace);
+#endif
+  write_raw_long(str, matrix.b.size());
+  for (long i=0; i<(long)matrix.b.size(); i++)
+    writeBinary(str, matrix.b[i]);
+  write_raw_ZZ(str, matrix.prgSeed);
+}
+
+void readBinary(BinaryInput& in, KeySwitch& matrix, const FHEcontext& context)
+{
+  readBinary(in, matrix.fromKey);
+  matrix.toKeyID = read_raw_long(in);
+#ifndef BIG_P
+  matrix.ptxtSpace = read_raw_long(in);
+#else
+  read_raw_ZZ(in, matrix.ptxtSpace);
+#endif
+  long nDigits = read_raw_length(in);
+  matrix.b.resize(nDigits, DoubleCRT(context, IndexSet::emptySet()));
+  for (long i=0; i<nDigits; i++)
+    readBinary(in, matrix.b[i]);
+  read_raw_ZZ(in, matrix.prgSeed);
+}
+
+void writeBinary(ostream& str, const FHEPubKey& pk)
+{
+  writeBinary(str, pk.pubEncrKey);
+
+  write_raw_long(str, pk.skHwts.size());
+  for (long i=0; i<(long)pk.skHwts.size(); i++)
+    write_raw_long(str, pk.skHwts[i]);
+
+  write_raw_long(str, pk.keySwitching.size());
+  for (long i=0; i<(long)pk.keySwitching.size(); i++)
+    writeBinary(str, pk.keySwitching[i]);
+
+  // The key-switching map is stored, so it need not be rebuilt on input
+  write_raw_long(str, pk.keySwitchMap.size());
+  for (long i=0; i<(long)pk.keySwitchMap.size(); i++) {
+    write_raw_long(str, pk.keySwitchMap[i].size());
+    for (long j=0; j<(long)pk.keySwitchMap[i].size(); j++)
+      write_raw_long(str, pk.keySwitchMap[i][j]);
+  }
+
+  write_raw_long(str, pk.recryptKeyID);
+  if (pk.recryptKeyID>=0) writeBinary(str, pk.recryptEkey);
+}
+
+void readBinary(BinaryInput& in, FHEPubKey& pk)
+{
+  FHE_TIMER_START;
+  pk.clear();
+  readBinary(in, pk.pubEncrKey);
+
+  pk.skHwts.resize(read_raw_length(in));
+  for (long i=0; i<(long)pk.skHwts.size(); i++)
+    pk.skHwts[i] = read_raw_long(in);
+
+  pk.keySwitching.resize(read_raw_length(in));
+  for (long i=0; i<(long)pk.keySwitching.size(); i++)
+    readBinary(in, pk.keySwitching[i], pk.getContext());
+
+  pk.keySwitchMap.resize(read_raw_length(in));
+  for (long i=0; i<(long)pk.keySwitchMap.size(); i++) {
+    pk.keySwitchMap[i].resize(read_raw_length(in));
+    for (long j=0; j<(long)pk.keySwitchMap[i].size(); j++)
+      pk.keySwitchMap[i][j] = read_raw_long(in);
+  }
+
+  pk.recryptKeyID = read_raw_long(in);
+  if (pk.recryptKeyID>=0) readBinary(in, pk.recryptEkey);
+}
+
+void writeBinary(ostream& str, const FHESecKey& sk)
+{
+  writeBinary(str, (const FHEPubKey&) sk);
+  write_raw_long(str, sk.sKeys.size());
+  for (long i=0; i<(long)sk.sKeys.size(); i++)
+    writeBinary(str, sk.sKeys[i]);
+}
+
+void readBinary(BinaryInput& in, FHESecKey& sk)
+{
+  sk.clear();
+  readBinary(in, (FHEPubKey&) sk);
+
+  long nKeys = read_raw_length(in);
+  sk.sKeys.resize(nKeys, DoubleCRT(sk.getContext(),IndexSet::emptySet()));
+  for (long i=0; i<nKeys; i++) {
+    readBinary(in, sk.sKeys[i]);
+    sk.addSparseKey(sk.sKeys[i]);
+  }
+}
+
+/******************** Contexts **********************/
+
+// The powers are stored as two rows of m residues
+static void writeModulusTables(ostream& str, const Cmodulus& mod)
+{
+  const CmodTables& t = mod.getTables();
+  long m = mod.getM();
+  vector<long> row(m);
+  write_raw_long(str, t.root);
+  for (long i=0; i<m; i++) row[i] = rep(coeff(t.powers, i));
+  write_raw_row(str, &row[0], m);
+  for (long i=0; i<m; i++) row[i] = rep(coeff(t.ipowers, i));
+  write_raw_row(str, &row[0], m);
+}
+
+// Everything but the header. With tables, every prime is followed by the
+// root of unity and the Bluestein powers of its Cmodulus (see CmodTables).
+static void writeContextData(ostream& str, const FHEcontext& context,
+                             bool withTables)
+{
+  // The data needed to construct the context
+  write_raw_long(str, context.zMStar.getM());
+#ifndef BIG_P
+  write_raw_long(str, context.zMStar.getP());
+  write_raw_long(str, context.alMod.getR());
+  long nGens = context.zMStar.numOfGens();
+  write_raw_long(str, nGens);
+  for (long i=0; i<nGens; i++)
+    write_raw_long(str, context.zMStar.ZmStarGen(i));
+  for (long i=0; i<nGens; i++)
+    write_raw_long(str, context.zMStar.OrderOf(i));
+#else
+  write_raw_ZZ(str, context.ModulusP());
+#endif
+
+  // All the other data
+  write_raw_xdouble(str, context.stdev);
+  write_raw_IndexSet(str, context.specialPrimes);
+  write_raw_long(str, context.numPrimes());
+  for (long i=0; i<context.numPrimes(); i++) {
+    write_raw_long(str, context.ithPrime(i));
+    if (withTables) writeModulusTables(str, context.ithModulus(i));
+  }
+  write_raw_long(str, context.digits.size());
+  for (long i=0; i<(long)context.digits.size(); i++)
+    write_raw_IndexSet(str, context.digits[i]);
+#ifndef BIG_P
+  const Vec<long>& mvec = context.rcData.mvec;
+  write_raw_long(str, mvec.length());
+  for (long i=0; i<mvec.length(); i++)
+    write_raw_long(str, mvec[i]);
+  write_raw_long(str, context.rcData.hwt);
+  write_raw_long(str, context.rcData.conservative);
+#endif
+
+  // The header cannot be checked before the context is built, so the
+  // fingerprint is repeated at the end
+  write_raw_long(str, (long) contextFingerprint(context));
+}
+
+void writeContextBinary(ostream& str, const FHEcontext& context)
+{
+  writeBinaryHeader(str, context, BIN_CONTEXT);
+  writeContextData(str, context, /*withTables=*/false);
+}
+
+#ifndef BIG_P
+void readContextBaseBinary(BinaryInput& in, unsigned long& m,
+                           unsigned long& p, unsigned long& r,
+                           vector<long>& gens, vector<long>& ords)
+{
+  readHeaderWords(in, BIN_CONTEXT);
+  m = read_raw_long(in);
+  p = read_raw_long(in);
+  r = read_raw_long(in);
+  long nGens = read_raw_length(in);
+  gens.resize(nGens);
+  ords.resize(nGens);
+  for (long i=0; i<nGens; i++) gens[i] = read_raw_long(in);
+  for (long i=0; i<nGens; i++) ords[i] = read_raw_long(in);
+}
+#else
+void readContextBaseBinary(BinaryInput& in, unsigned long& m, ZZ& p)
+{
+  readHeaderWords(in, BIN_CONTEXT);
+  m = read_raw_long(in);
+  read_raw_ZZ(in, p);
+}
+#endif
+
+static void readContextData(BinaryInput& in, FHEcontext& context,
+                            bool withTables)
+{
+  read_raw_xdouble(in, context.stdev);
+
+  IndexSet s;
+  read_raw_IndexSet(in, s); // the special primes
+
+  context.moduli.clear();
+  context.specialPrimes.clear();
+  context.ctxtPrimes.clear();
+
+  long nPrimes = read_raw_length(in);
+  for (long i=0; i<nPrimes; i++) {
+    long p = read_raw_long(in);
+
+    if (withTables) { // the saved tables, no root or powers to compute
+      long m = context.zMStar.getM();
+      long root = read_raw_long(in);
+      if (root <= 0 || root >= p)
+        Error("readContextBinary: bad root of unity");
+      vector<long> pw(m), ipw(m);
+      read_raw_row(in, &pw[0], m);
+      read_raw_row(in, &ipw[0], m);
+      context.moduli.push_back(Cmodulus(context.zMStar,p,root,&pw[0],&ipw[0]));
+    }
+    else if (ALT_CRT)
+      context.moduli.push_back(Cmodulus(context.zMStar,p,1)); // a dummy object
+    else
+      context.moduli.push_back(Cmodulus(context.zMStar,p,0)); // a real object
+
+    if (s.contains(i))
+      context.specialPrimes.insert(i); // special prime
+    else
+      context.ctxtPrimes.insert(i);    // ciphertext prime
+  }
+
+  context.digits.resize(read_raw_length(in));
+  for (long i=0; i<(long)context.digits.size(); i++)
+    read_raw_IndexSet(in, context.digits[i]);
+
+#ifndef BIG_P
+  Vec<long> mv;
+  mv.SetLength(read_raw_length(in));
+  for (long i=0; i<mv.length(); i++)
+    mv[i] = read_raw_long(in);
+  long t = read_raw_long(in);
+  bool consFlag = read_raw_long(in);
+  if (mv.length()>0) {
+    context.makeBootstrappable(mv, t, consFlag);
+  }
+#endif
+
+  if ((unsigned long) read_raw_long(in) != contextFingerprint(context))
+    Error("readContextBinary: corrupted context");
+}
+
+void readContextBinary(BinaryInput& in, FHEcontext& context)
+{
+  readContextData(in, context, /*withTables=*/false);
+}
+
+/******************** Snapshots **********************/
+
+void writeSnapshot(ostream& str, const FHEPubKey& pk)
+{
+  const FHEcontext& context = pk.getContext();
+  writeBinaryHeader(str, context, BIN_SNAPSHOT);
+  writeContextData(str, context, /*withTables=*/true);
+  writeBinary(str, pk);
+}
+
+// The context data starts with what is needed to construct it, as in
+// readContextBaseBinary
+Snapshot::Snapshot(const string& fileName)
+{
+  FHE_TIMER_START;
+  MappedFile file(fileName);
+  MemoryInput in(file.getData(), file.size());
+  unsigned long fingerprint = readHeaderWords(in, BIN_SNAPSHOT);
+
+#ifndef BIG_P
+  unsigned long m = read_raw_long(in);
+  unsigned long p = read_raw_long(in);
+  unsigned long r = read_raw_long(in);
+  long nGens = read_raw_length(in);
+  vector<long> gens(nGens), ords(nGens);
+  for (long i=0; i<nGens; i++) gens[i] = read_raw_long(in);
+  for (long i=0; i<nGens; i++) ords[i] = read_raw_long(in);
+  context.reset(new FHEcontext(m, p, r, gens, ords));
+#else
+  unsigned long m = read_raw_long(in);
+  ZZ p;
+  read_raw_ZZ(in, p);
+  context.reset(new FHEcontext(m, p));
+#endif
+  readContextData(in, *context, /*withTables=*/true);
+  if (fingerprint != contextFingerprint(*context))
+    Error("Snapshot: the header does not match the context");
+
+  pubKey.reset(new FHEPubKey(*context));
+  readBinary(in, *pubKey);
+}
+
+/******************** Ciphertext streams **********************/
+
+static void appendRawLong(string& buf, long x)
+{
+  unsigned long u = x;
+  for (long i = 0; i < 8; i++, u >>= 8)
+    buf.push_back((char)(unsigned char) u);
+}
+
+static string serialize(const Ctxt& c)
+{
+  ostringstream os;
+  writeBinary(os, c);
+  return os.str();
+}
+
+CtxtStreamWriter::CtxtStreamWriter(ostream& _str, const FHEcontext& context,
+                                   size_t _bufSize, bool _async):
+  str(_str), bufSize(_bufSize), async(_async), closed(false)
+{
+  writeBinaryHeader(str, context, BIN_CTXT_STREAM);
+}
+
+void CtxtStreamWriter::append(const string& record)
+{
+  if (closed) Error("CtxtStreamWriter: the stream is closed");
+  appendRawLong(pending, record.size());
+  pending += record;
+  if (pending.size() >= bufSize) flush();
+}
+
+void CtxtStreamWriter::wait()
+{
+#ifdef FHE_THREADS
+  if (flusher.joinable()) flusher.join();
+#endif
+  if (!str) Error("CtxtStreamWriter: write failed");
+}
+
+// Only one buffer is in flight, so memory is bounded by about 2*bufSize
+void CtxtStreamWriter::flush()
+{
+  wait();
+  inFlight.swap(pending);
+  pending.clear();
+#ifdef FHE_THREADS
+  if (async) {
+    flusher = thread([this]() { str.write(inFlight.data(), inFlight.size()); });
+    return;
+  }
+#endif
+  str.write(inFlight.data(), inFlight.size());
+}
+
+void CtxtStreamWriter::write(const Ctxt& c)
+{
+  FHE_TIMER_START;
+  append(serialize(c));
+}
+
+void CtxtStreamWriter::write(const vector<Ctxt>& v, long nthreads)
+{
+  FHE_TIMER_START;
+  vector<string> records(v.size());
+  parallelBatch(lsize(v), [&](long i) { records[i] = serialize(v[i]); },
+                nthreads);
+  for (size_t i = 0; i < records.size(); i++) append(records[i]);
+}
+
+void CtxtStreamWriter::close()
+{
+  if (closed) return;
+  appendRawLong(pending, 0);
+  closed = true;
+  flush();
+  wait();
+  str.flush();
+}
+
+CtxtStreamReader::CtxtStreamReader(BinaryInput& _in, const FHEPubKey& _pk,
+                                   bool _async):
+  in(_in), pk(_pk), async(_async), done(false), aheadPos(0), nAhead(0)
+{
+  readBinaryHeader(in, pk.getContext(), BIN_CTXT_STREAM);
+}
+
+bool CtxtStreamReader::nextRecord(vector<unsigned char>& buf)
+{
+  if (done) return false;
+  long n = read_raw_length(in);
+  if (n == 0) {
+    done = true;
+    return false;
+  }
+  buf.resize(n);
+  in.get(&buf[0], n);
+  return true;
+}
+
+// A record must be consumed exactly by the ciphertext it holds
+static void decodeRecord(Ctxt& c, const vector<unsigned char>& buf)
+{
+  MemoryInput min(&buf[0], buf.size());
+  readBinary(min, c);
+  if (min.remaining() != 0)
+    Error("CtxtStreamReader: bad record length");
+}
+
+bool CtxtStreamReader::takeRecord(vector<unsigned char>& buf)
+{
+  if (aheadPos < nAhead) {
+    buf.swap(ahead[aheadPos++]);
+    return true;
+  }
+  return nextRecord(buf);
+}
+
+void CtxtStreamReader::wait()
+{
+#ifdef FHE_THREADS
+  if (prefetcher.joinable()) prefetcher.join();
+#endif
+}
+
+// Only the prefetcher uses in and ahead until wait() returns
+void CtxtStreamReader::readAhead(long count)
+{
+  aheadPos = nAhead = 0;
+#ifdef FHE_THREADS
+  if (!async || done) return;
+  if (lsize(ahead) < count) ahead.resize(count);
+  prefetcher = thread([this, count]() {
+      while (nAhead < count && nextRecord(ahead[nAhead])) nAhead++;
+    });
+#else
+  (void) count;
+#endif
+}
+
+bool CtxtStreamReader::read(Ctxt& c)
+{
+  FHE_TIMER_START;
+  wait();
+  if (records.empty()) records.resize(1);
+  if (!takeRecord(records[0])) return false;
+  decodeRecord(c, records[0]);
+  return true;
+}
+
+// The records of the batch were read ahead (if possible), and those of the
+// next batch are read while this one is decoded in parallel
+long CtxtStreamReader::read(vector<Ctxt>& v, long maxCount, long nthreads)
+{
+  FHE_TIMER_START;
+  wait();
+  if (lsize(records) < maxCount) records.resize(maxCount);
+  long n = 0;
+  while (n < maxCount && takeRecord(records[n])) n++;
+  if (aheadPos == nAhead) readAhead(maxCount);
+
+  if (lsize(v) > n) v.erase(v.begin()+n, v.end());
+  while (lsize(v) < n) v.push_back(Ctxt(pk));
+  parallelBatch(n, [&](long i) { decodeRecord(v[i], records[i]); },
+                nthreads);
+  return n;
+}
+
+/******************** NFLlib interchange **********************/
+
+#ifdef BIG_P
+static const char nflMagic[8] = {'N','F','L','l','i','b','\0','\0'};
+
+NFLlibReader::NFLlibReader(BinaryInput& _in, const FHEPubKey& _pk):
+  in(_in), pk(_pk), done(false)
+{
+  const FHEcontext& context = pk.getContext();
+  long phim = context.zMStar.getPhiM();
+
+  char magic[8];
+  in.get(magic, 8);
+  if (memcmp(magic, nflMagic, 8) != 0)
+    Error("NFLlibReader: not an NFLlib stream");
+  if (read_raw_long(in) != phim)
+    Error("NFLlibReader: wrong ring dimension");
+
+  long k = read_raw_length(in);
+  vector<long> fileOrder(k); // the chain index of q_j
+  for (long j=0; j<k; j++) { // look for q_j in the chain
+    long q = read_raw_long(in);
+    const IndexSet& s = context.ctxtPrimes;
+    long i = s.first();
+    while (i <= s.last() && context.ithPrime(i) != q) i = s.next(i);
+    if (i > s.last() || primeSet.contains(i))
+      Error("NFLlibReader: modulus not in the chain, use integers instead");
+    primeSet.insert(i);
+    fileOrder[j] = i;
+  }
+
+  // The rows of a DoubleCRT follow the order of the chain, which may not
+  // be the order of the stream
+  rowOf.resize(k);
+  for (long j=0; j<k; j++) {
+    rowOf[j] = 0;
+    for (long i = primeSet.first(); i < fileOrder[j]; i = primeSet.next(i))
+      rowOf[j]++;
+  }
+
+  nBytes = read_raw_length(in);
+  if (k == 0) {
+    if (nBytes == 0) Error("NFLlibReader: no moduli");
+    primeSet = context.ctxtPrimes;
+  }
+  if (nBytes == 0) rows.resize(k*phim);
+  else             bytes.resize(phim*8*((nBytes+7)/8));
+}
+
+void NFLlibReader::readPoly(DoubleCRT& d)
+{
+  long phim = pk.getContext().zMStar.getPhiM();
+
+  if (nBytes == 0) {
+    for (long j=0; j<card(primeSet); j++)
+      read_raw_row(in, &rows[rowOf[j]*phim], phim);
+    d.fromResidues(&rows[0], primeSet);
+    return;
+  }
+
+  long padded = 8*((nBytes+7)/8);
+  in.get(&bytes[0], bytes.size());
+  ZZX poly;
+  poly.rep.SetLength(phim);
+  for (long j=0; j<phim; j++)
+    ZZFromBytes(poly.rep[j], &bytes[j*padded], nBytes);
+  poly.normalize();
+  d = poly; // reduce mod the primes of d
+}
+
+bool NFLlibReader::read(Ctxt& c, const ZZ& ptxtSpace)
+{
+  if (done) return false;
+  long tag = read_raw_long(in);
+  if (tag == 0) { done = true; return false; }
+  if (tag != 1) Error("NFLlibReader: corrupted stream");
+
+  FHE_TIMER_START;
+  const FHEcontext& context = pk.getContext();
+  DoubleCRT c0(context, primeSet), c1(context, primeSet);
+  readPoly(c0);
+  readPoly(c1);
+  pk.NFLlib2HElib(c, c0, c1, ptxtSpace);
+  return true;
+}
+
+NFLlibWriter::NFLlibWriter(ostream& _str, const FHEcontext& _context,
+                           const IndexSet& s, bool bigInt):
+  str(_str), context(_context), primeSet(s), nBytes(0), closed(false)
+{
+  long phim = context.zMStar.getPhiM();
+  if (empty(s) || !(s <= context.ctxtPrimes))
+    Error("NFLlibWriter: the primes must be ciphertext primes");
+
+  str.write(nflMagic, 8);
+  write_raw_long(str, phim);
+  write_raw_long(str, card(s));
+  for (long i = s.first(); i <= s.last(); i = s.next(i))
+    write_raw_long(str, context.ithPrime(i));
+
+  if (bigInt) nBytes = NumBytes(context.productOfPrimes(s));
+  write_raw_long(str, nBytes);
+  if (nBytes == 0) rows.resize(card(s)*phim);
+  else             bytes.resize(phim*8*((nBytes+7)/8));
+}
+
+void NFLlibWriter::writePoly(const DoubleCRT& d)
+{
+  long phim = context.zMStar.getPhiM();
+
+  if (nBytes == 0) {
+    d.toResidues(&rows[0]);
+    for (long j=0; j<card(primeSet); j++)
+      write_raw_row(str, &rows[j*phim], phim);
+    return;
+  }
+
+  long padded = 8*((nBytes+7)/8);
+  ZZX poly;
+  d.toPoly(poly, /*positive=*/true);
+  for (size_t j=0; j<bytes.size(); j++) bytes[j] = 0;
+  for (long j=0; j<=deg(poly); j++)
+    BytesFromZZ(&bytes[j*padded], poly.rep[j], nBytes);
+  str.write((const char*) &bytes[0], bytes.size());
+}
+
+void NFLlibWriter::write(const Ctxt& c)
+{
+  if (closed) Error("NFLlibWriter: the stream is closed");
+  if (c.getPrimeSet() != primeSet)
+    Error("NFLlibWriter: the ciphertext is not defined wrt the stream primes");
+  if (c.parts.size() != 2 || !c.parts[0].skHandle.isOne()
+      || !c.parts[1].skHandle.isBase(-1))
+    Error("NFLlibWriter: the ciphertext is not wrt (1,s)");
+
+  FHE_TIMER_START;
+  write_raw_long(str, 1);
+  writePoly(c.parts[0]);
+  writePoly(c.parts[1]);
+}
+
+void NFLlibWriter::close()
+{
+  if (closed) return;
+  write_raw_long(str, 0);
+  str.flush();
+  closed = true;
+}
+#endif // BIG_P
@@ -0,0 +1,412 @@
+/* Copyright (C) 2012,2013 IBM Corp.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef _BINIO_H_
+#define _BINIO_H_
+/**
+ * @file binio.h
+ * @brief Binary I/O of contexts, keys and ciphertexts
+ *
+ * The binary format is made of little-endian 64-bit words. A file starts
+ * with a header
+ *
+ *   "HElibMP\0" | format version | object type | context fingerprint
+ *
+ * which is checked on input against the context of the object being read,
+ * instead of validating every residue as the text format does. A DoubleCRT
+ * is stored as its prime-index table (the number of primes and their
+ * indexes in the chain) followed by one raw row of phi(m) residues per
+ * prime, with the same layout as in memory. Objects are written in a single
+ * pass, and read either from a stream or from a memory-mapped file, in
+ * which case every row is filled by a single memcpy.
+ *
+ * Typical usage:
+ * \code
+ *   ofstream out("key.bin", ios::binary);
+ *   writeBinaryHeader(out, context, BIN_PUBKEY);
+ *   writeBinary(out, publicKey);
+ *   ...
+ *   MappedFile file("key.bin");
+ *   MemoryInput in(file.getData(), file.size());
+ *   readBinaryHeader(in, context, BIN_PUBKEY);
+ *   readBinary(in, publicKey);
+ * \endcode
+ **/
+#include "NumbTh.h"
+#include "IndexSet.h"
+#include "multicore.h"
+
+class FHEcontext;
+class DoubleCRT;
+class SKHandle;
+class CtxtPart;
+class Ctxt;
+class CtxtView;
+class SeededCtxt;
+class PackedCtxt;
+class KeySwitch;
+class FHEPubKey;
+class FHESecKey;
+
+#define BINIO_VERSION 1
+
+//! The types of top-level objects, recorded in the header
+enum BinObjectType {
+  BIN_CONTEXT=1, BIN_CTXT=2, BIN_PUBKEY=3, BIN_SECKEY=4, BIN_SEEDED_CTXT=5,
+  BIN_PACKED_CTXT=6, BIN_CTXT_STREAM=7,
+  BIN_SNAPSHOT=8
+};
+
+/**
+ * @class BinaryInput
+ * @brief The source of the binary readers, either a stream or a buffer
+ **/
+class BinaryInput {
+public:
+  virtual ~BinaryInput() {}
+
+  //! @brief Copy the next n bytes to dst, raises an error if there are
+  //! fewer than n bytes left
+  virtual void get(void* dst, size_t n) = 0;
+};
+
+//! @brief Binary input from a stream (opened with ios::binary)
+class StreamInput: public BinaryInput {
+  istream& str;
+public:
+  explicit StreamInput(istream& _str): str(_str) {}
+  void get(void* dst, size_t n);
+};
+
+//! @brief Binary input from a buffer, e.g. a memory-mapped file
+class MemoryInput: public BinaryInput {
+  const unsigned char* pos;
+  const unsigned char* end;
+public:
+  MemoryInput(const void* buf, size_t len):
+    pos((const unsigned char*) buf), end(pos+len) {}
+  void get(void* dst, size_t n);
+
+  //! @brief Return a pointer to the next n bytes and skip them, without
+  //! copying anything
+  const void* skip(size_t n);
+
+  size_t remaining() const { return end-pos; }
+};
+
+/**
+ * @class MappedFile
+ * @brief A read-only memory mapping of a file, unmapped on destruction
+ **/
+class MappedFile {
+  void* data;
+  size_t len;
+
+  MappedFile(const MappedFile&);            // disable copy
+  MappedFile& operator=(const MappedFile&); // disable assignment
+public:
+  explicit MappedFile(const string& fileName);
+  ~MappedFile();
+
+  const void* getData() const { return data; }
+  size_t size() const { return len; }
+};
+
+//! @name Raw little-endian words
+///@{
+void write_raw_long(ostream& str, long x);
+long read_raw_long(BinaryInput& in);
+
+//! A ZZ is stored as its signed length in bytes, then the bytes of |x|
+//! padded to a multiple of 8
+void write_raw_ZZ(ostream& str, const ZZ& x);
+void read_raw_ZZ(BinaryInput& in, ZZ& x);
+
+void write_raw_xdouble(ostream& str, const xdouble& x);
+void read_raw_xdouble(BinaryInput& in, xdouble& x);
+
+void write_raw_IndexSet(ostream& str, const IndexSet& s);
+void read_raw_IndexSet(BinaryInput& in, IndexSet& s);
+
+//! A row of n words, written and read in one block on little-endian hosts
+void write_raw_row(ostream& str, const long* row, long n);
+void read_raw_row(BinaryInput& in, long* row, long n);
+///@}
+
+//! @brief A 64-bit hash of m, p, the primes in the chain and the digits.
+//! Objects can only be read into a context with the same fingerprint.
+unsigned long contextFingerprint(const FHEcontext& context);
+
+//! @brief Write the header of a file holding an object of the given type
+void writeBinaryHeader(ostream& str, const FHEcontext& context, long type);
+
+//! @brief Read a header and check it against the context and type, an
+//! error is raised if they do not match
+void readBinaryHeader(BinaryInput& in, const FHEcontext& context, long type);
+
+//! @name Binary I/O of the main classes
+//! The objects are written without a header, so several of them can follow
+//! a single header. As with the text format, the context of the object
+//! being read must already be set up.
+///@{
+void writeBinary(ostream& str, const DoubleCRT& d);
+void readBinary(BinaryInput& in, DoubleCRT& d);
+
+void writeBinary(ostream& str, const SKHandle& handle);
+void readBinary(BinaryInput& in, SKHandle& handle);
+
+void writeBinary(ostream& str, const CtxtPart& p);
+void readBinary(BinaryInput& in, CtxtPart& p);
+
+void writeBinary(ostream& str, const Ctxt& ctxt);
+void readBinary(BinaryInput& in, Ctxt& ctxt);
+
+//! @brief A view over a ciphertext in a buffer (e.g. a MappedFile), in
+//! place of readBinary. The buffer must outlive the view. Only supported
+//! on little-endian hosts with 64-bit longs.
+CtxtView readBinaryView(MemoryInput& in, const FHEPubKey& pk);
+
+//! A SeededCtxt is stored as its seed and c0, see Ctxt.h
+void writeBinary(ostream& str, const SeededCtxt& ctxt);
+void readBinary(BinaryInput& in, SeededCtxt& ctxt);
+
+//! A PackedCtxt is stored as its modulus and bit-packed coefficients
+void writeBinary(ostream& str, const PackedCtxt& ctxt);
+void readBinary(BinaryInput& in, PackedCtxt& ctxt);
+
+void writeBinary(ostream& str, const KeySwitch& matrix);
+void readBinary(BinaryInput& in, KeySwitch& matrix, const FHEcontext& context);
+
+void writeBinary(ostream& str, const FHEPubKey& pk);
+void readBinary(BinaryInput& in, FHEPubKey& pk);
+
+void writeBinary(ostream& str, const FHESecKey& sk);
+void readBinary(BinaryInput& in, FHESecKey& sk);
+///@}
+
+//! @name Binary I/O of contexts
+//! As with writeContextBase and operator<<, the context is written in one
+//! go, and read in two steps: first the data needed to construct it, then
+//! everything else.
+///@{
+void writeContextBinary(ostream& str, const FHEcontext& context);
+#ifndef BIG_P
+void readContextBaseBinary(BinaryInput& in, unsigned long& m,
+                           unsigned long& p, unsigned long& r,
+                           vector<long>& gens, vector<long>& ords);
+#else
+void readContextBaseBinary(BinaryInput& in, unsigned long& m, ZZ& p);
+#endif
+void readContextBinary(BinaryInput& in, FHEcontext& context);
+///@}
+
+/**
+ * @class Snapshot
+ * @brief A context and public key loaded from a deployment snapshot
+ *
+ * A snapshot, written by writeSnapshot, holds the context together with
+ * the root of unity and the Bluestein powers of every prime, so that the
+ * FFT tables are rebuilt without any modular exponentiation, followed by
+ * the public key with its key-switching matrices and key-switching map.
+ * It is loaded from a memory-mapped file in a single call:
+ * \code
+ *   Snapshot snap("worker.snap");
+ *   const FHEPubKey& publicKey = snap.getPubKey();
+ * \endcode
+ * The file is unmapped once the snapshot is loaded.
+ **/
+class Snapshot {
+  shared_ptr<FHEcontext> context;
+  shared_ptr<FHEPubKey> pubKey;   // destroyed before the context
+
+  Snapshot(const Snapshot&);            // disable copy
+  Snapshot& operator=(const Snapshot&); // disable assignment
+public:
+  explicit Snapshot(const string& fileName);
+
+  const FHEcontext& getContext() const { return *context; }
+  const FHEPubKey& getPubKey() const { return *pubKey; }
+};
+
+//! @brief Write a snapshot of the context of pk and of pk, see Snapshot
+void writeSnapshot(ostream& str, const FHEPubKey& pk);
+
+/**
+ * @class CtxtStreamWriter
+ * @brief Writes a stream of ciphertexts for batch jobs
+ *
+ * The stream is a header of type BIN_CTXT_STREAM followed by one record
+ * per ciphertext, made of its length in bytes and of the ciphertext as
+ * written by writeBinary, the end of the stream being marked by a length
+ * of 0. The records are serialized into a buffer which is written out once
+ * it holds bufSize bytes. With -DFHE_THREADS and async set, the buffer is
+ * written by a background thread while the next one is being filled.
+ **/
+class CtxtStreamWriter {
+  ostream& str;
+  size_t bufSize;
+  bool async;
+  bool closed;
+  string pending;   // records not yet handed to the stream
+  string inFlight;  // records being written
+#ifdef FHE_THREADS
+  thread flusher;
+#endif
+
+  CtxtStreamWriter(const CtxtStreamWriter&);            // disable copy
+  CtxtStreamWriter& operator=(const CtxtStreamWriter&); // disable assignment
+
+  void append(const string& record);
+  void flush();     // hand the pending records to the stream
+  void wait();      // wait for the write in progress, if any
+
+public:
+  //! @brief Writes the header, str must be opened with ios::binary
+  CtxtStreamWriter(ostream& _str, const FHEcontext& context,
+                   size_t _bufSize=(1UL<<24), bool _async=true);
+  ~CtxtStreamWriter() { close(); }
+
+  void write(const Ctxt& c);
+
+  //! @brief Write a batch, serialized on nthreads threads as in
+  //! parallelBatch (nthreads<=0 means all the threads of the pool)
+  void write(const vector<Ctxt>& v, long nthreads=0);
+
+  //! @brief Write the end marker and wait for all the records to be
+  //! written, nothing can be written after that
+  void close();
+};
+
+/**
+ * @class CtxtStreamReader
+ * @brief Reads a stream written by CtxtStreamWriter
+ *
+ * The ciphertexts are read one at a time, or in batches of a bounded size
+ * whose records are decoded in parallel. With -DFHE_THREADS and async set,
+ * once a batch is read the records of the next one are read by a background
+ * thread, while the current batch is decoded and used by the caller, so at
+ * most two batches are held in memory.
+ **/
+class CtxtStreamReader {
+  BinaryInput& in;
+  const FHEPubKey& pk;
+  bool async;
+  bool done;          // has the end marker been read?
+  vector< vector<unsigned char> > records; // the batch being decoded
+  vector< vector<unsigned char> > ahead;   // the next one, read in advance
+  long aheadPos, nAhead; // ahead[aheadPos..nAhead) are not consumed yet
+#ifdef FHE_THREADS
+  thread prefetcher;
+#endif
+
+  CtxtStreamReader(const CtxtStreamReader&);            // disable copy
+  CtxtStreamReader& operator=(const CtxtStreamReader&); // disable assignment
+
+  bool nextRecord(vector<unsigned char>& buf);
+  bool takeRecord(vector<unsigned char>& buf); // from ahead, else from in
+  void readAhead(long count); // start reading the next count records
+  void wait();                // wait for the read-ahead in progress, if any
+
+public:
+  //! @brief Reads the header, which must match the context of pk
+  CtxtStreamReader(BinaryInput& _in, const FHEPubKey& _pk, bool _async=true);
+  ~CtxtStreamReader() { wait(); }
+
+  //! @brief Read the next ciphertext, returns false at the end of the stream
+  bool read(Ctxt& c);
+
+  //! @brief Read up to maxCount ciphertexts into v, decoded on nthreads
+  //! threads. Returns the number read (the new size of v), 0 at the end.
+  long read(vector<Ctxt>& v, long maxCount, long nthreads=0);
+
+  bool eof() { wait(); return done && aheadPos == nAhead; }
+};
+
+#ifdef BIG_P
+/**
+ * @class NFLlibReader
+ * @brief Reads a stream of ciphertexts exchanged with NFLlib
+ *
+ * The stream holds ciphertexts (c0,c1) wrt (1,s) in coefficient form. It
+ * starts with
+ *
+ *   "NFLlib\0\0" | phi(m) | k | q_1 ... q_k | w
+ *
+ * and every ciphertext is preceded by the word 1, the end of the stream
+ * being marked by the word 0. When w=0, c0 and c1 are stored as k rows of
+ * phi(m) residues of their coefficients, modulo q_1,...,q_k, which must be
+ * primes of the chain: each row is turned into a row of the DoubleCRT with
+ * one FFT. The q_j may be listed in any order, the rows are placed under
+ * the matching primes. Otherwise the coefficients are stored as unsigned integers of w
+ * bytes (padded to a multiple of 8) modulo q_1*...*q_k, or modulo the
+ * product of the ciphertext primes of the context if k=0, for producers
+ * whose moduli do not match the chain. Only one ciphertext is held in
+ * memory at a time.
+ **/
+class NFLlibReader {
+  BinaryInput& in;
+  const FHEPubKey& pk;
+  IndexSet primeSet;  // the primes of the ciphertexts
+  vector<long> rowOf; // the row of the DoubleCRT for the j'th q_j
+  long nBytes;        // w
+  bool done;          // has the end of the stream been reached?
+  vector<long> rows;  // scratch space for the residues of one polynomial
+  vector<unsigned char> bytes; // same for the integers
+
+  void readPoly(DoubleCRT& d);
+
+public:
+  //! @brief Reads the header, which must match the context of pk
+  NFLlibReader(BinaryInput& _in, const FHEPubKey& _pk);
+
+  //! @brief Read the next ciphertext, returns false at the end of the stream
+  bool read(Ctxt& c, const ZZ& ptxtSpace=ZZ::zero());
+
+  const IndexSet& getPrimeSet() const { return primeSet; }
+};
+
+/**
+ * @class NFLlibWriter
+ * @brief Writes a stream of ciphertexts in the format of NFLlibReader
+ *
+ * The ciphertexts must be canonical and defined relative to the primes
+ * given to the constructor (e.g. after a mod-down to the last level).
+ **/
+class NFLlibWriter {
+  ostream& str;
+  const FHEcontext& context;
+  IndexSet primeSet;
+  long nBytes;        // 0 for residues
+  bool closed;
+  vector<long> rows;
+  vector<unsigned char> bytes;
+
+  void writePoly(const DoubleCRT& d);
+
+public:
+  //! @brief Residues modulo the primes of s, or integers modulo their
+  //! product if bigInt is set
+  NFLlibWriter(ostream& _str, const FHEcontext& _context, const IndexSet& s,
+               bool bigInt=false);
+  ~NFLlibWriter() { close(); }
+
+  void write(const Ctxt& c);
+
+  //! @brief Mark the end of the stream, nothing can be written after that
+  void close();
+};
+#endif // BIG_P
+
+#endif // _BINIO_H_
@@ -27,8 +27,6 @@
 void BluesteinInit(long n, const zz_p& root, zz_pX& powers, 
                    Vec<mulmod_precon_t>& powers_aux, fftRep& Rb)
 {
-  long p = zz_p::modulus();
-
   zz_p one; one=1;
   powers.SetMaxLength(n);
 
@@ -38,10 +36,27 @@ void BluesteinInit(long n, const zz_p& root, zz_pX& powers,
     SetCoeff(powers,i, power(root,iSqr)); // powers[i] = root^{i^2}
   }
 
+  zz_pX ipowers;
+  ipowers.SetMaxLength(n);
+  zz_p rInv = inv(root);
+  SetCoeff(ipowers,0,one);
+  for (long i=1; i<n; i++) {
+    long iSqr = MulMod(i, i, 2*n); // i^2 mod 2n
+    SetCoeff(ipowers,i, power(rInv,iSqr)); // ipowers[i] = root^{-i^2}
+  }
+
+  BluesteinTables(n, powers, ipowers, powers_aux, Rb);
+}
+
+void BluesteinTables(long n, const zz_pX& powers, const zz_pX& ipowers,
+                     Vec<mulmod_precon_t>& powers_aux, fftRep& Rb)
+{
+  long p = zz_p::modulus();
+
   // powers_aux tracks powers
   powers_aux.SetLength(n);
   for (long i = 0; i < n; i++)
-    powers_aux[i] = PrepMulModPrecon(rep(powers[i]), p);
+    powers_aux[i] = PrepMulModPrecon(rep(coeff(powers,i)), p);
 
 
   long k = NextPowerOfTwo(2*n-1);
@@ -50,11 +65,10 @@ void BluesteinInit(long n, const zz_p& root, zz_pX& powers,
   Rb.SetSize(k);
   zz_pX b(INIT_SIZE, k2);
 
-  zz_p rInv = inv(root);
+  zz_p one; one=1;
   SetCoeff(b,n-1,one); // b[n-1] = 1
   for (long i=1; i<n; i++) {
-    long iSqr = MulMod(i, i, 2*n); // i^2 mod 2n
-    zz_p bi = power(rInv,iSqr);
+    const zz_p& bi = coeff(ipowers,i);
     SetCoeff(b,n-1+i, bi); // b[n-1+i] = b[n-1-i] = root^{-i^2}
     SetCoeff(b,n-1-i,bi);              
   }
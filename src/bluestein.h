@@ -47,6 +47,12 @@
 void BluesteinInit(long n, const zz_p& root, zz_pX& powers, 
                    Vec<mulmod_precon_t>& powers_aux, fftRep& Rb);
 
+//! @brief the part of BluesteinInit that does not depend on root directly:
+//! powers_aux and Rb from powers[i]=root^{i^2} and ipowers[i]=root^{-i^2},
+//! e.g. when the powers were saved in a snapshot
+void BluesteinTables(long n, const zz_pX& powers, const zz_pX& ipowers,
+                     Vec<mulmod_precon_t>& powers_aux, fftRep& Rb);
+
 
 //! @brief apply bluestein
 void BluesteinFFT(zz_pX& x, long n, const zz_p& root, 
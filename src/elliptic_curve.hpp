@@ -1,6 +1,8 @@
 #ifndef ELLIPTIC_CURVE_HPP
 #define ELLIPTIC_CURVE_HPP
 
+#include "CtxtGraph.h"
+
 struct ECPoint
 {
 	Ctxt *X;
@@ -39,75 +41,212 @@ public:
 };
 
 // C = A+B
-void ec_addition(ECPoint& C, const ECPoint& A, const ECPoint& B, const ECPrecomputationEncrypted& precomputation, const FHEPubKey& publicKey)
+// The products are accumulated before re-linearization (see
+// Ctxt::addProduct), so each of T0..T5 and each coordinate of C costs a
+// single key-switching operation: 9 in total, instead of the 15 of one
+// per product (9 in the first stage, 6 for C). Each coordinate of A enters
+// three products; with prepared=true it is prepared once for them (see
+// PreparedCtxt).
+void ec_addition(ECPoint& C, const ECPoint& A, const ECPoint& B, const ECPrecomputationEncrypted& precomputation, const FHEPubKey& publicKey, bool prepared=true)
 {
-	Ctxt X1X2 = *A.X, X1Y2 = *A.X, X1Z2 = *A.X;
-	Ctxt Y1X2 = *A.Y, Y1Y2 = *A.Y, Y1Z2 = *A.Y;
-	Ctxt Z1X2 = *A.Z, Z1Y2 = *A.Z, Z1Z2 = *A.Z;
-
-	X1X2.multiplyBy(*B.X);
-	X1Y2.multiplyBy(*B.Y);
-	X1Z2.multiplyBy(*B.Z);
+	Ctxt X1X2(publicKey), Z1Z2(publicKey), XZ(publicKey);
+	Ctxt T0(publicKey), T1(publicKey), T3(publicKey);
 
-	Y1X2.multiplyBy(*B.X);
-	Y1Y2.multiplyBy(*B.Y);
-	Y1Z2.multiplyBy(*B.Z);
+	if (prepared) {
+		PreparedCtxt X1(*A.X), Y1(*A.Y), Z1(*A.Z);
 
-	Z1X2.multiplyBy(*B.X);
-	Z1Y2.multiplyBy(*B.Y);
-	Z1Z2.multiplyBy(*B.Z);
+		X1X2.addProduct(X1, *B.X);
+		Z1Z2.addProduct(Z1, *B.Z);
+		XZ.addProduct(X1, *B.Z);
+			XZ.addProduct(Z1, *B.X);
+		T0.addProduct(X1, *B.Y);
+			T0.addProduct(Y1, *B.X);
+		T1.addProduct(Y1, *B.Y);
+		T3.addProduct(Y1, *B.Z);
+			T3.addProduct(Z1, *B.Y);
+	}
+	else {
+		X1X2.addProduct(*A.X, *B.X);
+		Z1Z2.addProduct(*A.Z, *B.Z);
+		XZ.addProduct(*A.X, *B.Z);
+			XZ.addProduct(*A.Z, *B.X);
+		T0.addProduct(*A.X, *B.Y);
+			T0.addProduct(*A.Y, *B.X);
+		T1.addProduct(*A.Y, *B.Y);
+		T3.addProduct(*A.Y, *B.Z);
+			T3.addProduct(*A.Z, *B.Y);
+	}
 
-	Ctxt T0(publicKey), T1(publicKey), T2(publicKey);
-	Ctxt T3(publicKey), T4(publicKey), T5(publicKey);
+	Ctxt T2(publicKey), T4(publicKey), T5(publicKey);
 
 	Ctxt tmp(publicKey);
 
-	T0 = X1Y2;
-		T0 += Y1X2;
-	T1 = Y1Y2;
-	T2 = X1Z2;
-		T2 += Z1X2;
+	T0.reLinearize();
+	T1.reLinearize();
+	T3.reLinearize();
+	T2 = XZ;
 		tmp = Z1Z2;
 		tmp.multByConstant(precomputation.b);
 		T2 -= tmp;
 		T2.multByConstant(precomputation.three);
-	T3 = Y1Z2;
-		T3 += Z1Y2;
-	T4 = X1Z2;
-		T4 += Z1X2;
+		T2.reLinearize();
+	T4 = XZ;
 		T4.multByConstant(precomputation.b);
 		tmp = Z1Z2;
 		tmp.multByConstant(precomputation.three);
 		T4 -= X1X2;
 		T4 -= tmp;
+		T4.reLinearize();
 	T5 = X1X2;
 		T5 -= Z1Z2;
 		T5.multByConstant(precomputation.three);
+		T5.reLinearize();
 
-	*C.X = T1;
-		*C.X += T2;
-		C.X->multiplyBy(T0);
-		tmp = T3;
-		tmp.multiplyBy(T4);
+	Ctxt C1(publicKey), C2(publicKey);
+
+	C.X->clear();
+		C1 = T1;
+		C1 += T2;
+		C.X->addProduct(C1, T0);
+		tmp.clear();
+		tmp.addProduct(T3, T4);
 		tmp.multByConstant(precomputation.three);
 		*C.X -= tmp;
+		C.X->reLinearize();
 
-	*C.Y = T1;
-		*C.Y -= T2;
-		tmp = T1;
-		tmp += T2;
-		C.Y->multiplyBy(tmp);
-		tmp = T4;
-		tmp.multiplyBy(T5);
+	C.Y->clear();
+		C2 = T1;
+		C2 -= T2;
+		C.Y->addProduct(C2, C1);
+		tmp.clear();
+		tmp.addProduct(T4, T5);
 		tmp.multByConstant(precomputation.three);
 		*C.Y += tmp;
+		C.Y->reLinearize();
+
+	C.Z->clear();
+		C.Z->addProduct(C2, T3);
+		C.Z->addProduct(T0, T5);
+		C.Z->reLinearize();
+}
+
+// The task graph of ec_addition: the nine products of the first stage,
+// then T2, T4, T5 and the products of each coordinate, run as soon as their
+// inputs are ready (see CtxtGraph). The graph is built by the first call to
+// run(), later calls only bind it to new points, so a sequence of additions
+// (e.g. the levels of a product tree) reuses the same ciphertext buffers.
+// One object must not be run by several threads at once.
+class ECAdditionGraph {
+	typedef CtxtGraph::Node Node;
+
+	const ECPrecomputationEncrypted& precomputation;
+	CtxtGraph g;
+	Node in[6], out[3];
+
+	void build(const ECPoint& A, const ECPoint& B)
+	{
+		typedef vector< pair<Node,Node> > Terms;
+		typedef const vector<const Ctxt*>& In;
+		const DoubleCRT* b = &precomputation.b;
+		const DoubleCRT* three = &precomputation.three;
+
+		Node X1 = in[0] = g.input(*A.X);
+		Node Y1 = in[1] = g.input(*A.Y);
+		Node Z1 = in[2] = g.input(*A.Z);
+		Node X2 = in[3] = g.input(*B.X);
+		Node Y2 = in[4] = g.input(*B.Y);
+		Node Z2 = in[5] = g.input(*B.Z);
+
+		Node X1X2 = g.sumOfProducts(Terms{{X1,X2}}, false);
+		Node Z1Z2 = g.sumOfProducts(Terms{{Z1,Z2}}, false);
+		Node XZ = g.sumOfProducts(Terms{{X1,Z2}, {Z1,X2}}, false);
+		Node T0 = g.sumOfProducts(Terms{{X1,Y2}, {Y1,X2}});
+		Node T1 = g.sumOfProducts(Terms{{Y1,Y2}});
+		Node T3 = g.sumOfProducts(Terms{{Y1,Z2}, {Z1,Y2}});
+
+		Node T2 = g.op({XZ, Z1Z2}, [b, three](Ctxt& out, In in) {
+			Ctxt tmp(*in[1]);
+			tmp.multByConstant(*b);
+			out = *in[0];
+			out -= tmp;
+			out.multByConstant(*three);
+			out.reLinearize();
+		});
+		Node T4 = g.op({XZ, X1X2, Z1Z2}, [b, three](Ctxt& out, In in) {
+			Ctxt tmp(*in[2]);
+			tmp.multByConstant(*three);
+			out = *in[0];
+			out.multByConstant(*b);
+			out -= *in[1];
+			out -= tmp;
+			out.reLinearize();
+		});
+		Node T5 = g.op({X1X2, Z1Z2}, [three](Ctxt& out, In in) {
+			out = *in[0];
+			out -= *in[1];
+			out.multByConstant(*three);
+			out.reLinearize();
+		});
 
-	*C.Z = T1;
-		*C.Z -= T2;
-		C.Z->multiplyBy(T3);
-		tmp = T0;
-		tmp.multiplyBy(T5);
-		*C.Z += tmp;
+		Node C1 = g.add(T1, T2);
+		Node C2 = g.sub(T1, T2);
+
+		// out = in[0] + sign*3*in[1], re-linearized
+		auto combine = [three](long sign) {
+			return [three, sign](Ctxt& out, In in) {
+				Ctxt tmp(*in[1]);
+				tmp.multByConstant(*three);
+				out = *in[0];
+				if (sign > 0) out += tmp;
+				else          out -= tmp;
+				out.reLinearize();
+			};
+		};
+		out[0] = g.op({g.sumOfProducts(Terms{{C1,T0}}, false),
+		               g.sumOfProducts(Terms{{T3,T4}}, false)}, combine(-1));
+		out[1] = g.op({g.sumOfProducts(Terms{{C2,C1}}, false),
+		               g.sumOfProducts(Terms{{T4,T5}}, false)}, combine(+1));
+		out[2] = g.sumOfProducts(Terms{{C2,T3}, {T0,T5}});
+	}
+
+public:
+	ECAdditionGraph(const ECPrecomputationEncrypted& _precomputation, const FHEPubKey& publicKey):
+	precomputation(_precomputation),
+	g(publicKey)
+	{ }
+
+	// C = A+B, C may be A or B
+	void run(ECPoint& C, const ECPoint& A, const ECPoint& B)
+	{
+		if (g.size() == 0)
+			build(A, B);
+		else {
+			g.setInput(in[0], *A.X); g.setInput(in[1], *A.Y); g.setInput(in[2], *A.Z);
+			g.setInput(in[3], *B.X); g.setInput(in[4], *B.Y); g.setInput(in[5], *B.Z);
+		}
+		g.output(out[0], *C.X);
+		g.output(out[1], *C.Y);
+		g.output(out[2], *C.Z);
+		g.run();
+	}
+
+	// For the statistics of the last run
+	const CtxtGraph& graph() const { return g; }
+	const ECPrecomputationEncrypted& getPrecomputation() const { return precomputation; }
+};
+
+// Same as ec_addition, as a task graph (see ECAdditionGraph). If graph is
+// given, it is reused instead of building a new one for this addition.
+void ec_addition_graph(ECPoint& C, const ECPoint& A, const ECPoint& B, const ECPrecomputationEncrypted& precomputation, const FHEPubKey& publicKey, ECAdditionGraph* graph=NULL)
+{
+	if (graph != NULL) {
+		assert(&graph->getPrecomputation() == &precomputation);
+		graph->run(C, A, B);
+	}
+	else {
+		ECAdditionGraph local(precomputation, publicKey);
+		local.run(C, A, B);
+	}
 }
 #endif
 
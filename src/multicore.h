@@ -27,185 +27,285 @@
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <deque>
+#include <functional>
+#include <cstdlib>
 #include <NTL/SmartPtr.h>
+#include "NumbTh.h"
 
 using namespace std;
 using namespace NTL;
 
 
 
-template<class T>
-class SimpleSignal {
-private:
-  T val; 
-  mutex m;
-  condition_variable cv;
-
-  SimpleSignal(const SimpleSignal&); // disabled
-  void operator=(const SimpleSignal&); // disabled
-
+/**
+ * @class ThreadPool
+ * @brief A work-stealing pool shared by all the parallel code of the library
+ *
+ * Every worker has its own deque of jobs: it pushes and pops at the back,
+ * and steals from the front of the others when its own deque is empty.
+ * Threads from outside the pool share one more deque. A thread waiting for
+ * its jobs runs those that are still queued, wherever they are in the
+ * deques, so a job may itself start parallel work (e.g. ciphertext-level
+ * jobs spawning per-prime FFTs) without creating more threads. Once all its
+ * jobs are taken by others, the waiting thread sleeps until the last one
+ * completes or a running one submits a new job.
+ *
+ * The pool counts the calling thread, so it has getNumThreads()-1 workers.
+ * The default size is given by the environment variable FHE_NUM_THREADS,
+ * or is the number of cores, and can be changed with setNumThreads.
+ **/
+class ThreadPool {
 public:
-  SimpleSignal() : val(0) { }
+  //! @brief The jobs of one fork-join, waited for together
+  class TaskGroup {
+    friend class ThreadPool;
+    atomic<long> pending;   // jobs not completed yet
+    atomic<long> inQueue;   // jobs still in a queue, updated under its lock
+    mutex mx;               // the last job completes under this lock
+    condition_variable done; // a job completed or was submitted
+  public:
+    TaskGroup() : pending(0), inQueue(0) { }
+  };
+
+private:
+  typedef pair< function<void()>, TaskGroup* > Job;
+  struct JobQueue {
+    mutex mx;
+    deque<Job> jobs;
+  };
 
-  T wait() 
+  long nthreads;
+  vector< shared_ptr<JobQueue> > queues; // the last one is for other threads
+  vector<thread> workers;
+  atomic<long> queued;  // total number of jobs in the queues
+  bool stopping;
+  mutex sleepMx;
+  condition_variable sleepCv;
+
+  ThreadPool(const ThreadPool&); // disabled
+  void operator=(const ThreadPool&); // disabled
+
+  // The index of the worker running this thread, -1 outside the pool
+  static long& selfIndex()
   {
-    unique_lock<mutex> lock(m);
-    cv.wait(lock, [&]() { return val; } );
-    T old_val = val;
-    val = 0;
-    return old_val;
+    static thread_local long index = -1;
+    return index;
   }
 
-  void send(T new_val)
+  long myQueue() const
   {
-    lock_guard<mutex> lock(m);
-    val = new_val;
-    cv.notify_one();
+    long self = selfIndex();
+    return (self < 0)? lsize(queues)-1 : self;
   }
-};
-
-
 
-class ConcurrentTask {
-public:
-  virtual void run(long index) = 0;
-};
-
-template<class Fct>
-class ConcurrentTaskFct : public ConcurrentTask {
-public:
-  Fct fct;
-  ConcurrentTaskFct(Fct&& _fct) : fct(std::move(_fct)) { }
-
-  void run(long index) { fct(index); }
-};
-
-template<class Fct>
-class ConcurrentTaskFct1 : public ConcurrentTask {
-public:
-  Fct fct;
-  const Vec<long>& pvec;
-  ConcurrentTaskFct1(Fct&& _fct, const Vec<long>& _pvec) : 
-    fct(std::move(_fct)), pvec(_pvec)  { }
-
-  void run(long index) { fct(pvec[index], pvec[index+1]); }
-};
-
-
-struct MultiTask;
-inline void doMultiTask(MultiTask *multiTask, long index);
-
-struct MultiTask {
-  long nthreads;
-
-  atomic<long> counter;
-  SimpleSignal<bool> globalSignal;
-  Vec< SimpleSignal< ConcurrentTask * > > localSignal;
-
-  MultiTask(const MultiTask&); // disabled
-  void operator=(const MultiTask&); // disabled
-
-  MultiTask(long _nthreads) : nthreads(_nthreads), counter(0)
+  // Take the newest job of our own queue, or steal the oldest of another
+  bool take(Job& job)
   {
-    assert(nthreads > 0);
-
-    localSignal.SetLength(nthreads);
-
-    for (long i = 0; i < nthreads; i++) {
-      thread t(doMultiTask, this, i);
-      t.detach();
-
-      // I may want to think about leaving these threads
-      // attached and joining with them in the destructor
-      // somehow
+    long n = queues.size(), self = myQueue();
+    for (long k = 0; k < n; k++) {
+      JobQueue& q = *queues[(self+k) % n];
+      lock_guard<mutex> lock(q.mx);
+      if (q.jobs.empty()) continue;
+      if (k == 0) {
+        job = std::move(q.jobs.back());
+        q.jobs.pop_back();
+      } else {
+        job = std::move(q.jobs.front());
+        q.jobs.pop_front();
+      }
+      job.second->inQueue--;
+      queued--;
+      return true;
     }
+    return false;
   }
 
-  void begin(long cnt)
+  // Take a job of group wherever it is in the queues: the newest one of
+  // our own queue, or the oldest one of another queue. Jobs of other groups
+  // may sit in front of ours, and jobs of a group may also be submitted by
+  // its jobs, to the queue of the thread running them.
+  bool takeFrom(Job& job, TaskGroup& group)
   {
-    assert(cnt > 0 && cnt <= nthreads);
+    long n = queues.size(), self = myQueue();
+    for (long k = 0; k < n && group.inQueue > 0; k++) {
+      JobQueue& q = *queues[(self+k) % n];
+      lock_guard<mutex> lock(q.mx);
+      deque<Job>::iterator it;
+      if (k == 0) {
+        deque<Job>::reverse_iterator r = q.jobs.rbegin();
+        while (r != q.jobs.rend() && r->second != &group) ++r;
+        if (r == q.jobs.rend()) continue;
+        it = --r.base();
+      } else {
+        it = q.jobs.begin();
+        while (it != q.jobs.end() && it->second != &group) ++it;
+        if (it == q.jobs.end()) continue;
+      }
+      job = std::move(*it);
+      q.jobs.erase(it);
+      group.inQueue--;
+      queued--;
+      return true;
+    }
+    return false;
+  }
 
-    counter = cnt;
+  // The group is updated under its lock: the waiter takes the lock before
+  // returning, so the group is not destroyed while we still use it
+  static void run(Job& job)
+  {
+    job.first();
+    TaskGroup& group = *job.second;
+    lock_guard<mutex> lock(group.mx);
+    if (--group.pending == 0) group.done.notify_all();
   }
 
-  void end()
+  void workerLoop(long index)
   {
-    globalSignal.wait();
+    selfIndex() = index;
+    Job job;
+    for (;;) {
+      if (take(job)) { run(job); continue; }
+      unique_lock<mutex> lock(sleepMx);
+      sleepCv.wait(lock, [&]() { return stopping || queued > 0; });
+      if (stopping) return;
+    }
   }
 
-  void launch(ConcurrentTask *task, long index)
+  void start(long n)
   {
-    assert(task != 0 && index >= 0 && index < nthreads);
+    nthreads = max(n, 1L);
+    stopping = false;
+    queues.clear();
+    for (long i = 0; i < nthreads; i++)
+      queues.push_back(shared_ptr<JobQueue>(new JobQueue));
+    for (long i = 0; i < nthreads-1; i++)
+      workers.push_back(thread(&ThreadPool::workerLoop, this, i));
+  }
 
-    localSignal[index].send(task);
+  void stop()
+  {
+    { lock_guard<mutex> lock(sleepMx); stopping = true; }
+    sleepCv.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+    workers.clear();
   }
 
-  
+public:
+  explicit ThreadPool(long n) : queued(0) { start(n); }
+  ~ThreadPool() { stop(); }
 
-  // High level interfaces, intended to be used with lambdas
+  long getNumThreads() const { return nthreads; }
 
-  // In this version, fct takes one argument, which is
-  // an index in [0..cnt)
+  //! @brief Change the number of threads, n<=0 means the default. Must not
+  //! be called while parallel work is running.
+  void setNumThreads(long n);
 
-  template<class Fct>
-  void exec(long cnt, Fct fct) 
+  //! @brief Queue f as a job of group. The caller must be the thread that
+  //! waits for group, or one of its jobs.
+  void submit(TaskGroup& group, function<void()> f)
   {
-    ConcurrentTaskFct<Fct> task(std::move(fct));
+    group.pending++;
+    JobQueue& q = *queues[myQueue()];
+    { lock_guard<mutex> lock(q.mx);
+      q.jobs.push_back(Job(std::move(f), &group));
+      group.inQueue++; }
+    queued++;
+    { lock_guard<mutex> lock(sleepMx); } // no lost wake-up
+    sleepCv.notify_one();
+    { lock_guard<mutex> lock(group.mx); } // nor for a waiter of group
+    group.done.notify_all();
+  }
 
-    begin(cnt);
-    for (long t = 0; t < cnt; t++) launch(&task, t);
-    end();
+  //! @brief Wait for the jobs of group, running those not yet taken
+  void wait(TaskGroup& group)
+  {
+    Job job;
+    while (group.pending > 0) {
+      if (takeFrom(job, group)) { run(job); continue; }
+
+      // Everything is taken by other threads: sleep until the last job
+      // completes, or until a running job submits a new one
+      unique_lock<mutex> lock(group.mx);
+      group.done.wait(lock, [&]() {
+          return group.pending == 0 || group.inQueue > 0; });
+    }
+    lock_guard<mutex> lock(group.mx); // the last run() is done with group
   }
 
-  // even higher level version: sz is the number of subproblems,
-  // and fct takes two args, first and last, so that subproblems
-  // [first..last) are processed.
+  // High level interfaces, intended to be used with lambdas
 
+  // fct takes one argument, an index in [0..cnt), and each call is a job
   template<class Fct>
-  void exec1(long sz, Fct fct) 
+  void exec(long cnt, Fct fct)
   {
-    Vec<long> pvec;
-    long cnt = SplitProblems(sz, pvec);
-    ConcurrentTaskFct1<Fct> task(std::move(fct), pvec);
-
-    begin(cnt);
-    for (long t = 0; t < cnt; t++) launch(&task, t);
-    end();
+    if (cnt <= 0) return;
+    TaskGroup group;
+    for (long t = 1; t < cnt; t++)
+      submit(group, [&fct, t]() { fct(t); });
+    fct(0);
+    wait(group);
   }
 
-
-  // splits nproblems problems among (at most) nthreads threads.
-  // returns the actual number of threads nt to be used, and 
+  // splits nproblems problems among (at most) getNumThreads() threads.
+  // returns the actual number of threads nt to be used, and
   // initializes pvec to have length nt+1, so that for t = 0..nt-1,
   // thread t processes subproblems pvec[t]..pvec[t+1]-1
   long SplitProblems(long nproblems, Vec<long>& pvec) const
   {
     long blocksz = (nproblems + nthreads - 1)/nthreads;
     long nt = (nproblems + blocksz - 1)/blocksz;
-  
+
     pvec.SetLength(nt+1);
-  
+
     for (long t = 0; t < nt; t++) pvec[t] = blocksz*t;
     pvec[nt] = nproblems;
-  
+
     return nt;
   }
 
+  // sz is the number of subproblems, and fct takes two args, first and
+  // last, so that subproblems [first..last) are processed. The subproblems
+  // are split in (at most) getNumThreads() ranges.
+  template<class Fct>
+  void exec1(long sz, Fct fct)
+  {
+    if (sz <= 0) return;
+    long blocksz = (sz + nthreads - 1)/nthreads;
+    long nt = (sz + blocksz - 1)/blocksz;
+    exec(nt, [&](long t) { fct(blocksz*t, min(sz, blocksz*(t+1))); });
+  }
+};
 
-  long getNumThreads() const { return nthreads; }
-
+//! @brief FHE_NUM_THREADS if it is set and positive, else the number of cores
+inline long defaultNumThreads()
+{
+  const char* env = getenv("FHE_NUM_THREADS");
+  long n = (env != NULL)? atol(env) : 0;
+  if (n <= 0) n = thread::hardware_concurrency();
+  return max(n, 1L);
+}
 
-};
+inline void ThreadPool::setNumThreads(long n)
+{
+  if (n <= 0) n = defaultNumThreads();
+  if (n == nthreads) return;
+  stop();
+  start(n);
+}
 
-inline void doMultiTask(MultiTask *multiTask, long index)
+//! @brief The pool of the library, created on first use
+inline ThreadPool& getThreadPool()
 {
-  for (;;) {
-    ConcurrentTask *task = multiTask->localSignal[index].wait();
-    task->run(index);
-    if (--(multiTask->counter) == 0) multiTask->globalSignal.send(true);
-  }
+  static ThreadPool pool(defaultNumThreads());
+  return pool;
 }
 
+//! @brief The number of threads used by the library (with -DFHE_THREADS)
+inline void setNumThreads(long n) { getThreadPool().setNumThreads(n); }
+inline long getNumThreads() { return getThreadPool().getNumThreads(); }
+
 #define FHE_atomic_long atomic_long
 #define FHE_atomic_ulong atomic_ulong
 
@@ -220,6 +320,10 @@ inline void doMultiTask(MultiTask *multiTask, long index)
 #define FHE_MUTEX_TYPE int
 #define FHE_MUTEX_GUARD(mx) ((void) mx)
 
+// Without threads, everything runs on the calling thread
+inline void setNumThreads(long n) { (void) n; }
+inline long getNumThreads() { return 1; }
+
 #endif
 
 
@@ -0,0 +1,221 @@
+/* Copyright (C) 2012,2013 IBM Corp.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+/* paramTuning.cpp - searching for fast parameters for a BIG_P context
+ */
+#include "paramTuning.h"
+
+#ifdef BIG_P
+#include <sys/time.h>
+#include "FHE.h"
+#include "Ctxt.h"
+
+static double wallTime()
+{
+  struct timeval t;
+  gettimeofday(&t, NULL);
+  return ((double)t.tv_sec) + ((double)t.tv_usec)/1000000.;
+}
+
+ostream& operator<< (ostream &str, const FHEParams& prm)
+{
+  str << "[m=" << prm.m << " L=" << prm.nLevels << " c=" << prm.nDgts
+      << " nPrimesByLvl=" << prm.nPrimesByLvl
+      << " security=" << prm.security << " mul=" << prm.mulTime << "s"
+      << (prm.correct? "" : " (incorrect)") << "]";
+  return str;
+}
+
+// After a multiplication the noise is about (B^2 * phi(m) * f) with f the
+// factor (Q mod p)^{-1} < p, and B ~ p*sqrt(phi(m)*hwt) the noise after
+// mod-switching. Hence one level must remove about
+// 2*log(p) + 1.5*log(phi(m)) + log(hwt) bits.
+long estimatePrimesByLvl(const ZZ& p, long m, long hwt)
+{
+  double phim = phi_N(m);
+  double bits = 2.0*NumBits(p) + 1.5*log2(phim) + log2((double)hwt);
+  return (long) ceil(bits/(FHE_DEFAULT_p2Size/2.0));
+}
+
+void probeParams(FHEParams& prm, ZZ& p, long hwt)
+{
+  FHEcontext context(prm.m, p);
+  buildModChain(context, prm.nLevels, prm.nDgts, prm.nPrimesByLvl);
+  prm.security = context.securityLevel();
+
+  FHESecKey secretKey(context);
+  secretKey.GenSecKey(hwt, p);
+
+  ZZX ptxt = to_ZZX(p-1);
+  Ctxt c(secretKey);
+  secretKey.Encrypt(c, ptxt, p);
+
+  double start = wallTime();
+  for (long i=0; i<prm.nLevels; i++)
+    c.multiplyBy(c);
+  prm.mulTime = (prm.nLevels>0)? (wallTime()-start)/prm.nLevels : 0.0;
+
+  c.modDownToLevel(c.findBaseLevel());
+  c.cleanUp();
+  secretKey.Decrypt(ptxt, c);
+  prm.correct = IsOne(ptxt); // (p-1)^(2^L) = 1 mod p
+}
+
+bool TuneParams(FHEParams& best, ZZ& p, long nLevels, long k,
+                long hwt, ostream* contextOut, bool verbose)
+{
+  const long maxTries = 4; // how far above the estimate we search
+  const long minPhiM = 256; // do not go below that even if k<=0
+  best = FHEParams();
+
+  for (long c=2; c<=4; c++) {
+    // The number of primes depends (weakly) on m and vice versa, so we
+    // start from a guess and refine it once
+    long nPrimes = estimatePrimesByLvl(p, 1024, hwt);
+    long primeM = FindM(k, nLevels, c, p, nPrimes, 0);
+    if (primeM == 0) continue;
+    nPrimes = estimatePrimesByLvl(p, primeM, hwt);
+
+    // Candidates for m: the smallest suitable prime and power of two
+    vector<long> ms;
+    long m0 = FindM(k, nLevels, c, p, nPrimes, 0);
+    if (m0 == 0) continue;
+    if (phi_N(m0) < minPhiM) m0 = NextPrime(minPhiM+1);
+    ms.push_back(m0);
+    long twoPow = 1L << (NextPowerOfTwo(phi_N(m0))+1); // phi(2^e)=2^{e-1}
+    ms.push_back(FindM(k, nLevels, c, p, nPrimes, twoPow));
+
+    for (size_t i=0; i<ms.size(); i++) {
+      if (ms[i] == 0) continue;
+      for (long j=0; j<maxTries; j++) {
+        FHEParams prm(ms[i], nLevels, c, nPrimes+2*j);
+        probeParams(prm, p, hwt);
+        if (verbose) cerr << "*** probe " << prm << endl;
+
+        if (k>0 && prm.security < k) break; // adding primes will not help
+        if (!prm.correct) continue;         // try with more primes
+        if (!best.correct || prm.mulTime < best.mulTime)
+          best = prm;
+        break;
+      }
+    }
+  }
+  if (!best.correct) return false;
+
+  if (contextOut != NULL) {
+    FHEcontext context(best.m, p);
+    buildModChain(context, best.nLevels, best.nDgts, best.nPrimesByLvl);
+    writeContextBase(*contextOut, context);
+    *contextOut << context;
+  }
+  return true;
+}
+// Run the calibration circuit over the given context, recording after each
+// level the measured noise, its estimate, and the remaining headroom (all in
+// bits). Returns true if the headroom never ran out.
+static bool runCircuit(const FHEcontext& context, ZZ& p, long nLevels,
+                       long hwt, CalibrationStep step,
+                       vector<double>& actual, vector<double>& estimated,
+                       vector<double>& headroom)
+{
+  FHESecKey secretKey(context);
+  secretKey.GenSecKey(hwt, p);
+
+  Ctxt c(secretKey);
+  secretKey.Encrypt(c, to_ZZX(p-1), p);
+
+  actual.clear(); estimated.clear(); headroom.clear();
+  bool ok = true;
+  for (long lvl=0; lvl<=nLevels; lvl++) {
+    if (lvl>0) {
+      if (step != NULL) step(c);
+      else              c.multiplyBy(c);
+    }
+    // Noise against the zero polynomial is the size of <c,s> mod Q, i.e.
+    // of m + p*e before the reduction mod p
+    ZZX zero;
+    double logQ = context.logOfProduct(c.getPrimeSet())/log(2.0);
+
+    actual.push_back(secretKey.Noise(zero, c));
+    estimated.push_back(log(c.getNoiseVar())/2/log(2.0));
+    headroom.push_back(logQ - 1 - actual.back());
+    if (headroom.back() <= 0) ok = false;
+  }
+  return ok;
+}
+
+bool calibrateModChain(ChainCalibration& cal, long m, ZZ& p, long nLevels,
+                       long nDgts, long nPrimesByLvl, long hwt,
+                       CalibrationStep step, double margin, bool verbose)
+{
+  const double unit = FHE_DEFAULT_p2Size/2.0; // bits per half-size prime
+  vector<double> headroom;
+
+  // Measure the circuit over an over-provisioned uniform chain
+  {
+    FHEcontext context(m, p);
+    buildModChain(context, nLevels, nDgts, nPrimesByLvl);
+    cal.uniformPrimes = card(context.ctxtPrimes);
+    if (!runCircuit(context, p, nLevels, hwt, step,
+                    cal.actualBits, cal.estimatedBits, headroom)) {
+      if (verbose) cerr << "*** calibrateModChain: uniform chain too small\n";
+      return false;
+    }
+  }
+
+  vector<double> consumed(nLevels+1);
+  consumed[0] = cal.actualBits[0] + 1; // fresh noise must be below Q/2
+  for (long i=1; i<=nLevels; i++) {
+    consumed[i] = headroom[i-1] - headroom[i];
+    if (consumed[i] < 0) consumed[i] = 0;
+  }
+
+  if (verbose) {
+    for (long i=0; i<=nLevels; i++)
+      cerr << "*** level " << i << ": noise " << cal.actualBits[i]
+           << " bits (estimated " << cal.estimatedBits[i]
+           << "), consumed " << consumed[i] << " bits\n";
+  }
+
+  // Size the chain to the bits consumed by all the levels, then verify the
+  // result. Since mod-switching is driven by the (conservative) noise estimates,
+  // the measured amounts may not suffice, in which case we add a prime
+  // to the margin and try again.
+  for (long attempt=0; attempt<3; attempt++, margin += unit) {
+    cal.primesByLvl.resize(nLevels+1);
+    cal.totalHalfPrimes = 0;
+    for (long i=0; i<=nLevels; i++) {
+      cal.primesByLvl[i] = (long) ceil((consumed[i]+margin)/unit);
+      cal.totalHalfPrimes += cal.primesByLvl[i];
+    }
+
+    FHEcontext context(m, p);
+    buildModChainByTotal(context, cal.totalHalfPrimes, nDgts);
+    cal.calibratedPrimes = card(context.ctxtPrimes);
+
+    vector<double> actual, estimated;
+    if (runCircuit(context, p, nLevels, hwt, step,
+                   actual, estimated, headroom)) {
+      if (verbose)
+        cerr << "*** calibrated chain length: " << cal.calibratedPrimes
+             << " primes instead of " << cal.uniformPrimes << " ("
+             << 100.0*(cal.uniformPrimes-cal.calibratedPrimes)/cal.uniformPrimes
+             << "% total prime-count reduction)\n";
+      return true;
+    }
+  }
+  return false;
+}
+#endif // BIG_P
@@ -0,0 +1,104 @@
+/* Copyright (C) 2012,2013 IBM Corp.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef _paramTuning_H_
+#define _paramTuning_H_
+/**
+ * @file paramTuning.h
+ * @brief Searching for fast parameters and modulus chains for BIG_P contexts
+ *
+ * Given the size of the plaintext modulus, the multiplicative depth and the
+ * target security, the tuner goes over a few values of m and of the number
+ * of digits, and for each of them looks for the smallest number of primes
+ * per level that still decrypts correctly after nLevels multiplications.
+ * Each candidate is checked with a short probe (key generation, nLevels
+ * squarings and a decryption), and the fastest one is returned.
+ **/
+#include "FHEContext.h"
+
+#ifdef BIG_P
+
+//! @brief A candidate parameter set for a BIG_P context
+class FHEParams {
+public:
+  long m;            // the cyclotomic index
+  long nLevels;      // the multiplicative depth
+  long nDgts;        // number of digits in key-switching
+  long nPrimesByLvl; // number of half-size primes per level
+
+  double security;   // as estimated by FHEcontext::securityLevel()
+  double mulTime;    // average time (sec) of multiplyBy, incl. relinearization
+  bool   correct;    // did the probe decrypt correctly?
+
+  FHEParams(long _m=0, long L=0, long c=3, long n=0):
+    m(_m), nLevels(L), nDgts(c), nPrimesByLvl(n),
+    security(0.0), mulTime(0.0), correct(false) {}
+};
+ostream& operator<< (ostream &str, const FHEParams& prm);
+
+//! @brief Estimate the number of half-size primes per level from the noise
+//! model: a level must absorb the growth of the noise in one multiplication
+//! (including the factor (Q mod p)^{-1} of the tensor product)
+long estimatePrimesByLvl(const ZZ& p, long m, long hwt);
+
+//! @brief Run a probe for the parameters m, nLevels, nDgts, nPrimesByLvl:
+//! generate keys, square an encryption of p-1 nLevels times and decrypt.
+//! Sets the security, mulTime and correct fields of prm.
+void probeParams(FHEParams& prm, ZZ& p, long hwt=64);
+
+//! @brief Search for the fastest parameter set with nLevels levels and at
+//! least k bits of security (k<=0 => no security constraint) that decrypts
+//! correctly. If contextOut!=NULL, the corresponding context is written
+//! to it (as writeContextBase followed by operator<<).
+//! Returns false if no suitable parameters were found.
+bool TuneParams(FHEParams& best, ZZ& p, long nLevels, long k,
+                long hwt=64, ostream* contextOut=NULL, bool verbose=false);
+
+class Ctxt;
+
+//! @brief One step of the circuit used for calibration, applied once per
+//! level. The default (NULL) step squares the ciphertext.
+typedef void (*CalibrationStep)(Ctxt& c);
+
+//! @brief The result of calibrating the length of a modulus chain
+class ChainCalibration {
+public:
+  vector<long>   primesByLvl;   // half-size primes consumed by each level
+  long totalHalfPrimes;  // their sum, the length of the calibrated chain
+  vector<double> actualBits;    // measured noise (bits) after each level
+  vector<double> estimatedBits; // estimated noise, log2(sqrt(noiseVar))
+  long uniformPrimes;    // number of ctxt primes in the uniform chain
+  long calibratedPrimes; // number of ctxt primes in the calibrated chain
+
+  ChainCalibration(): totalHalfPrimes(0), uniformPrimes(0), calibratedPrimes(0) {}
+};
+
+//! @brief Calibrate the total length of the modulus chain for a circuit.
+//! Run the circuit (nLevels applications of step) over a uniform chain with
+//! nPrimesByLvl primes per level, measure the actual noise after each level
+//! with FHESecKey::Noise, and compute how many primes each level really
+//! consumes (plus margin bits). Only the sum is used: the calibrated chain
+//! is still uniform, of length sum(primesByLvl) (see buildModChainByTotal),
+//! since mod-switching drops primes as the noise requires rather than at
+//! fixed level boundaries. The primes are not sized per level. The chain
+//! is checked by running the circuit again over it. Returns false if the
+//! calibrated chain could not be verified.
+bool calibrateModChain(ChainCalibration& cal, long m, ZZ& p, long nLevels,
+                       long nDgts, long nPrimesByLvl, long hwt=64,
+                       CalibrationStep step=NULL, double margin=8.0,
+                       bool verbose=false);
+
+#endif // BIG_P
+#endif // _paramTuning_H_
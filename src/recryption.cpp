@@ -421,7 +421,7 @@ void extractDigitsPacked(Ctxt& ctxt, long botHigh, long r, long ePrime,
     FHE_NTIMER_START(unpack2);
     vector<Ctxt> frob(d, Ctxt(ZeroCtxtLike, ctxt));
 
-    bootTask->exec1(d,
+    getThreadPool().exec1(d,
       [&](long first, long last) {
         for (long j = first; j < last; j++) { // process jth Frobenius 
           frob[j] = ctxt;
@@ -461,7 +461,7 @@ void extractDigitsPacked(Ctxt& ctxt, long botHigh, long r, long ePrime,
     topHigh--; // For p==2 we sometime get a bit for free
 
   FHE_NTIMER_START(extractDigits);
-  bootTask->exec1(d,
+  getThreadPool().exec1(d,
     [&](long first, long last) {
       for (long i = first; i < last; i++) {
         vector<Ctxt> scratch;